@@ -6489,6 +6489,14 @@ mz_bool mz_zip_writer_add_mem_ex_v2(mz_zip_archive *pZip, const char *pArchive_n
 
 mz_bool mz_zip_writer_add_read_buf_callback(mz_zip_archive *pZip, const char *pArchive_name, mz_file_read_func read_callback, void* callback_opaque, mz_uint64 max_size, const MZ_TIME_T *pFile_time, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags,
                                 const char *user_extra_data, mz_uint user_extra_data_len, const char *user_extra_data_central, mz_uint user_extra_data_central_len)
+{
+    return mz_zip_writer_add_read_buf_callback_v2(pZip, pArchive_name, read_callback, callback_opaque, max_size, pFile_time, pComment, comment_size, level_and_flags,
+                                                  user_extra_data, user_extra_data_len, user_extra_data_central, user_extra_data_central_len, NULL, NULL);
+}
+
+mz_bool mz_zip_writer_add_read_buf_callback_v2(mz_zip_archive *pZip, const char *pArchive_name, mz_file_read_func read_callback, void* callback_opaque, mz_uint64 max_size, const MZ_TIME_T *pFile_time, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags,
+                                const char *user_extra_data, mz_uint user_extra_data_len, const char *user_extra_data_central, mz_uint user_extra_data_central_len,
+                                const mz_uint64 *pUncomp_size, const mz_uint32 *pUncomp_crc32)
 {
     mz_uint16 gen_flags;
     mz_uint uncomp_crc32 = MZ_CRC32_INIT, level, num_alignment_padding_bytes;
@@ -6524,8 +6532,8 @@ mz_bool mz_zip_writer_add_read_buf_callback(mz_zip_archive *pZip, const char *pA
         pState->m_zip64 = MZ_TRUE;
     }
 
-    /* We could support this, but why? */
-    if (level_and_flags & MZ_ZIP_FLAG_COMPRESSED_DATA)
+    /* Already compressed data is only read back once the caller supplies its uncompressed size and crc. */
+    if ((level_and_flags & MZ_ZIP_FLAG_COMPRESSED_DATA) && ((!pUncomp_size) || (!pUncomp_crc32) || (level_and_flags & MZ_ZIP_FLAG_WRITE_HEADER_SET_SIZE)))
         return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
 
     if (!mz_zip_writer_validate_archive_name(pArchive_name))
@@ -6590,7 +6598,7 @@ mz_bool mz_zip_writer_add_read_buf_callback(mz_zip_archive *pZip, const char *pA
         MZ_ASSERT((cur_archive_file_ofs & (pZip->m_file_offset_alignment - 1)) == 0);
     }
 
-    if (max_size && level)
+    if (max_size && (level || (level_and_flags & MZ_ZIP_FLAG_COMPRESSED_DATA)))
     {
         method = MZ_DEFLATED;
     }
@@ -6667,7 +6675,7 @@ mz_bool mz_zip_writer_add_read_buf_callback(mz_zip_archive *pZip, const char *pA
             return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
         }
 
-        if (!level)
+        if ((!level) || (level_and_flags & MZ_ZIP_FLAG_COMPRESSED_DATA))
         {
             while (1)
             {
@@ -6686,11 +6694,17 @@ mz_bool mz_zip_writer_add_read_buf_callback(mz_zip_archive *pZip, const char *pA
                     return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
                 }
                 file_ofs += n;
-                uncomp_crc32 = (mz_uint32)mz_crc32(uncomp_crc32, (const mz_uint8 *)pRead_buf, n);
+                if (!(level_and_flags & MZ_ZIP_FLAG_COMPRESSED_DATA))
+                    uncomp_crc32 = (mz_uint32)mz_crc32(uncomp_crc32, (const mz_uint8 *)pRead_buf, n);
                 cur_archive_file_ofs += n;
             }
             uncomp_size = file_ofs;
-            comp_size = uncomp_size;
+            comp_size = file_ofs;
+            if (level_and_flags & MZ_ZIP_FLAG_COMPRESSED_DATA)
+            {
+                uncomp_size = *pUncomp_size;
+                uncomp_crc32 = *pUncomp_crc32;
+            }
         }
         else
         {
@@ -1367,6 +1367,12 @@ MINIZ_EXPORT mz_bool mz_zip_writer_add_read_buf_callback(mz_zip_archive *pZip, c
 	const MZ_TIME_T *pFile_time, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags, const char *user_extra_data_local, mz_uint user_extra_data_local_len,
 	const char *user_extra_data_central, mz_uint user_extra_data_central_len);
 
+/* Like mz_zip_writer_add_read_buf_callback(), except the callback may supply already compressed (raw deflate) data with MZ_ZIP_FLAG_COMPRESSED_DATA. */
+/* max_size then bounds both the compressed and the uncompressed size. The values behind pUncomp_size and pUncomp_crc32 are read after the callback returned 0, so they may be filled in while streaming. */
+MINIZ_EXPORT mz_bool mz_zip_writer_add_read_buf_callback_v2(mz_zip_archive *pZip, const char *pArchive_name, mz_file_read_func read_callback, void* callback_opaque, mz_uint64 max_size,
+	const MZ_TIME_T *pFile_time, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags, const char *user_extra_data_local, mz_uint user_extra_data_local_len,
+	const char *user_extra_data_central, mz_uint user_extra_data_central_len, const mz_uint64 *pUncomp_size, const mz_uint32 *pUncomp_crc32);
+
 
 #ifndef MINIZ_NO_STDIO
 /* Adds the contents of a disk file to an archive. This function also records the disk file's modified time into the archive. */
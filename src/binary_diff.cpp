@@ -0,0 +1,344 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include "binary_diff.h"
+
+using Index = int32_t;
+using Clock = std::chrono::steady_clock;
+
+// a match is never searched (nor scored) further than this: on repetitive data every match runs until the end
+// of the data, scoring each of them in full made the diff quadratic. a longer match is found again right after
+static constexpr size_t MAX_MATCH_SIZE = 64 * 1024;
+
+// how far the backward extension of a match can overlap the forward extension of the one before it
+static constexpr ptrdiff_t MAX_OVERLAP = 4096;
+
+// sorts the group [start, start + length) of the suffixes by their next h characters (Larsson & Sadakane).
+// I holds the suffixes, a negative value -n marks n suffixes that are already sorted.
+// V holds the group of every suffix (the index of the last suffix of its group in I).
+static void s_split(Index* I, Index* V, Index start, Index length, Index h) {
+    while (true) {
+        if (length < 16) {
+            // small groups: selection sort
+            for (Index k = start, j; k < start + length; k += j) {
+                j = 1;
+                Index x = V[I[k] + h];
+                for (Index i = 1; k + i < start + length; i++) {
+                    if (V[I[k + i] + h] < x) {
+                        x = V[I[k + i] + h];
+                        j = 0;
+                    }
+                    if (V[I[k + i] + h] == x) {
+                        std::swap(I[k + j], I[k + i]);
+                        j++;
+                    }
+                }
+
+                for (Index i = 0; i < j; i++) {
+                    V[I[k + i]] = k + j - 1;
+                }
+                if (j == 1) {
+                    I[k] = -1;
+                }
+            }
+            return;
+        }
+
+        // three way partition around the middle suffix: less, equal, greater
+        const Index x = V[I[start + length / 2] + h];
+        Index less = 0, equal = 0;
+        for (Index i = start; i < start + length; i++) {
+            less += V[I[i] + h] < x;
+            equal += V[I[i] + h] == x;
+        }
+
+        const Index lessEnd = start + less;
+        const Index equalEnd = lessEnd + equal;
+        Index i = start, j = 0, k = 0;
+        while (i < lessEnd) {
+            if (V[I[i] + h] < x) {
+                i++;
+            } else if (V[I[i] + h] == x) {
+                std::swap(I[i], I[lessEnd + j]);
+                j++;
+            } else {
+                std::swap(I[i], I[equalEnd + k]);
+                k++;
+            }
+        }
+
+        while (lessEnd + j < equalEnd) {
+            if (V[I[lessEnd + j] + h] == x) {
+                j++;
+            } else {
+                std::swap(I[lessEnd + j], I[equalEnd + k]);
+                k++;
+            }
+        }
+
+        if (lessEnd > start) {
+            s_split(I, V, start, lessEnd - start, h);
+        }
+
+        for (i = 0; i < equalEnd - lessEnd; i++) {
+            V[I[lessEnd + i]] = equalEnd - 1;
+        }
+        if (lessEnd == equalEnd - 1) {
+            I[lessEnd] = -1;
+        }
+
+        // the greater part is sorted by the loop, so the recursion only goes as deep as the smaller parts
+        if (start + length <= equalEnd) {
+            return;
+        }
+        length = start + length - equalEnd;
+        start = equalEnd;
+    }
+}
+
+// the suffix array of data: I[0] is the empty suffix, then all the suffixes in order.
+// nullopt once the deadline passed (repetitive data needs a pass per doubling of its longest repeat,
+// all of its suffixes in each)
+static std::optional<std::vector<Index> > s_suffixArray(std::string_view data, Clock::time_point deadline) {
+    const auto size = static_cast<Index>(data.size());
+    const auto byte = [&](Index i) { return static_cast<unsigned char>(data[i]); };
+
+    std::vector<Index> I(size + 1), V(size + 1);
+
+    // first pass: bucket sort by the first byte
+    Index buckets[256] = {};
+    for (Index i = 0; i < size; i++) {
+        buckets[byte(i)]++;
+    }
+    for (int i = 1; i < 256; i++) {
+        buckets[i] += buckets[i - 1];
+    }
+    for (int i = 255; i > 0; i--) {
+        buckets[i] = buckets[i - 1];
+    }
+    buckets[0] = 0;
+
+    for (Index i = 0; i < size; i++) {
+        I[++buckets[byte(i)]] = i;
+    }
+    I[0] = size;
+    for (Index i = 0; i < size; i++) {
+        V[i] = buckets[byte(i)];
+    }
+    V[size] = 0;
+    for (int i = 1; i < 256; i++) {
+        if (buckets[i] == buckets[i - 1] + 1) {
+            I[buckets[i]] = -1;
+        }
+    }
+    I[0] = -1;
+
+    // then keep doubling the sorted prefix length until every suffix is in its own group
+    for (Index h = 1; I[0] != -(size + 1); h += h) {
+        Index sorted = 0;
+        Index i = 0;
+        while (i < size + 1) {
+            if (I[i] < 0) {
+                sorted -= I[i];
+                i -= I[i];
+            } else {
+                if (sorted) {
+                    I[i - sorted] = -sorted;
+                }
+                const Index length = V[I[i]] + 1 - i;
+                s_split(I.data(), V.data(), i, length, h);
+                if (Clock::now() > deadline) {
+                    return std::nullopt;
+                }
+                i += length;
+                sorted = 0;
+            }
+        }
+        if (sorted) {
+            I[i - sorted] = -sorted;
+        }
+    }
+
+    for (Index i = 0; i < size + 1; i++) {
+        I[V[i]] = i;
+    }
+    return I;
+}
+
+static size_t s_matchLength(std::string_view a, std::string_view b) {
+    const auto length = std::min(a.size(), b.size());
+    size_t i = 0;
+    while (i < length && a[i] == b[i]) {
+        i++;
+    }
+    return i;
+}
+
+// the longest prefix of target that exists in the old data, binary searched in its suffix array
+static size_t s_search(const std::vector<Index>& I, std::string_view old, std::string_view target, size_t& position) {
+    size_t start = 0, end = old.size();
+    while (end - start >= 2) {
+        const size_t middle = start + (end - start) / 2;
+        // a suffix that is a prefix of the target sorts before it too, or runs of equal bytes would always
+        // end at their shortest suffix (a 1 byte match, searched again at the next byte)
+        const auto suffix = old.substr(I[middle]);
+        const auto order = std::memcmp(suffix.data(), target.data(), std::min(suffix.size(), target.size()));
+        if (order < 0 || (order == 0 && suffix.size() < target.size())) {
+            start = middle;
+        } else {
+            end = middle;
+        }
+    }
+
+    const auto x = s_matchLength(old.substr(I[start]), target);
+    const auto y = s_matchLength(old.substr(I[end]), target);
+    position = x > y ? I[start] : I[end];
+    return std::max(x, y);
+}
+
+GramFilter::GramFilter(std::string_view data) {
+    while (bits < 30 && (size_t{1} << bits) < data.size() * 4) {
+        bits++;
+    }
+
+    bitmap.resize(((size_t{1} << bits) + 63) / 64);
+    for (size_t i = 0; i + GRAM_SIZE <= data.size(); i++) {
+        const auto slot = hash(data.data() + i);
+        bitmap[slot / 64] |= uint64_t{1} << (slot % 64);
+    }
+}
+
+bool GramFilter::mayContain(const char *gram) const {
+    const auto slot = hash(gram);
+    return bitmap[slot / 64] >> (slot % 64) & 1;
+}
+
+size_t GramFilter::hash(const char *gram) const {
+    uint64_t value;
+    std::memcpy(&value, gram, sizeof(value));
+    return static_cast<size_t>(value * 0x9E3779B97F4A7C15ULL >> (64 - bits));
+}
+
+std::optional<std::vector<DiffControl> > binaryDiff(std::string_view oldData, std::string_view newData, const GramFilter& grams,
+                                                   Clock::time_point deadline) {
+    if (oldData.size() >= static_cast<size_t>(std::numeric_limits<Index>::max())) {
+        throw std::runtime_error("Binary diff input is too large");
+    }
+
+    const auto sorted = s_suffixArray(oldData, deadline);
+    if (!sorted) {
+        return std::nullopt;
+    }
+    const auto &I = *sorted;
+    const auto oldSize = static_cast<ptrdiff_t>(oldData.size());
+    const auto newSize = static_cast<ptrdiff_t>(newData.size());
+    const auto equalAt = [&](ptrdiff_t oldPos, ptrdiff_t newPos) {
+        return oldPos >= 0 && oldPos < oldSize && oldData[oldPos] == newData[newPos];
+    };
+
+    std::vector<DiffControl> controls;
+    size_t steps = 0; // the deadline is only checked every few thousand positions
+    ptrdiff_t scan = 0, length = 0, position = 0;
+    ptrdiff_t lastScan = 0, lastPosition = 0, lastOffset = 0;
+    while (scan < newSize) {
+        if (Clock::now() > deadline) {
+            return std::nullopt;
+        }
+
+        // find the next exact match that is clearly better (8 bytes) than just continuing the last one
+        ptrdiff_t oldScore = 0;
+        ptrdiff_t scored = scan += length;
+        for (; scan < newSize; scan++) {
+            // a position that can't start an 8 byte match isn't worth a search
+            if (scan + static_cast<ptrdiff_t>(GramFilter::GRAM_SIZE) <= newSize && !grams.mayContain(newData.data() + scan)) {
+                length = 0;
+            } else {
+                size_t found = 0;
+                length = static_cast<ptrdiff_t>(s_search(I, oldData, newData.substr(scan, MAX_MATCH_SIZE), found));
+                position = static_cast<ptrdiff_t>(found);
+            }
+
+            // oldScore: how many bytes of [scan, scan + length) continuing the last match would get right
+            for (; scored < scan + length; scored++) {
+                oldScore += equalAt(scored + lastOffset, scored);
+            }
+            for (; scored > scan + length; scored--) {
+                oldScore -= equalAt(scored - 1 + lastOffset, scored - 1);
+            }
+            if (++steps % 4096 == 0 && Clock::now() > deadline) {
+                return std::nullopt;
+            }
+
+            if ((length == oldScore && length != 0) || length > oldScore + 8) {
+                break;
+            }
+
+            // the window moves on: scan leaves it
+            if (scored > scan) {
+                oldScore -= equalAt(scan + lastOffset, scan);
+            } else {
+                scored = scan + 1;
+            }
+        }
+
+        if (length == oldScore && scan != newSize) {
+            continue;
+        }
+
+        // extend the last match forwards, as long as at least half of the bytes are equal
+        ptrdiff_t forward = 0;
+        for (ptrdiff_t i = 0, same = 0, best = 0; lastScan + i < scan && lastPosition + i < oldSize;) {
+            same += equalAt(lastPosition + i, lastScan + i);
+            i++;
+            if (same * 2 - i > best * 2 - forward) {
+                best = same;
+                forward = i;
+            }
+        }
+
+        // and the new match backwards, over what the last match didn't cover (and a bit of it to choose the split).
+        // going all the way back to lastScan on uniform data kept lastScan in place, each match scanned everything again
+        ptrdiff_t backward = 0;
+        if (scan < newSize) {
+            const ptrdiff_t limit = std::min(scan - lastScan, scan - lastScan - forward + MAX_OVERLAP);
+            for (ptrdiff_t i = 1, same = 0, best = 0; i <= limit && position >= i; i++) {
+                same += equalAt(position - i, scan - i);
+                if (same * 2 - i > best * 2 - backward) {
+                    best = same;
+                    backward = i;
+                }
+            }
+        }
+
+        // both extensions overlap: split them where the most bytes are equal
+        if (lastScan + forward > scan - backward) {
+            const ptrdiff_t overlap = lastScan + forward - (scan - backward);
+            ptrdiff_t split = 0;
+            for (ptrdiff_t i = 0, same = 0, best = 0; i < overlap; i++) {
+                same += equalAt(lastPosition + forward - overlap + i, lastScan + forward - overlap + i);
+                same -= equalAt(position - backward + i, scan - backward + i);
+                if (same > best) {
+                    best = same;
+                    split = i + 1;
+                }
+            }
+
+            forward += split - overlap;
+            backward -= split;
+        }
+
+        controls.push_back({
+            .oldOffset = static_cast<size_t>(lastPosition),
+            .diffLength = static_cast<size_t>(forward),
+            .extraLength = static_cast<size_t>(scan - backward - (lastScan + forward)),
+        });
+
+        lastScan = scan - backward;
+        lastPosition = position - backward;
+        lastOffset = position - scan;
+    }
+
+    return controls;
+}
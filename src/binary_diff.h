@@ -0,0 +1,48 @@
+#ifndef BINARY_DIFF_H
+#define BINARY_DIFF_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+// one step of a binary diff, the steps write the output from its start:
+// diffLength bytes that are the input bytes at oldOffset plus a (byte by byte) difference,
+// then extraLength bytes that follow them in the output, written as is
+struct DiffControl {
+    size_t oldOffset;
+    size_t diffLength;
+    size_t extraLength;
+};
+
+// the 8 byte strings of some data, hashed into a bitmap (4 bits per byte of data, so ~20% false positives).
+// data that has almost none of its 8 byte strings in the old data is new, no diff can do better than writing it
+class GramFilter {
+public:
+    static constexpr size_t GRAM_SIZE = sizeof(uint64_t);
+
+    explicit GramFilter(std::string_view data);
+
+    // false if the GRAM_SIZE bytes at gram are surely not in the data
+    [[nodiscard]] bool mayContain(const char* gram) const;
+
+private:
+    [[nodiscard]] size_t hash(const char* gram) const;
+
+    int bits = 16;
+    std::vector<uint64_t> bitmap;
+};
+
+// bsdiff: a suffix array of the old data finds the longest exact matches of the new data, each match is then
+// extended forwards & backwards as long as at least half of the bytes are still equal. recompiled executables
+// mostly differ by shifted addresses, which leaves long ranges that are almost equal (small differences that
+// compress very well) instead of the short exact blocks the rolling match would find.
+// positions that grams (built from the old data) rules out aren't searched for a match.
+// memory: 8 bytes per old byte while sorting, the old data can't be bigger than 2 GB.
+// gives up (nullopt) once the deadline passed, sorting the suffixes of repetitive data takes a lot longer.
+std::optional<std::vector<DiffControl> > binaryDiff(std::string_view oldData, std::string_view newData, const GramFilter& grams,
+                                                   std::chrono::steady_clock::time_point deadline);
+
+#endif //BINARY_DIFF_H
@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <stdexcept>
+#include "block_delta.h"
+
+// a run of equal bytes shorter than this costs more (two varints) than writing it again
+static constexpr size_t MIN_SAME = 4;
+
+static void s_putVarint(std::string& out, size_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+static size_t s_getVarint(std::string_view data, size_t& pos) {
+    size_t value = 0;
+    for (size_t shift = 0; shift < sizeof(size_t) * 8; shift += 7) {
+        if (pos >= data.size()) {
+            break;
+        }
+
+        const auto byte = static_cast<unsigned char>(data[pos++]);
+        value |= static_cast<size_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+
+    throw std::runtime_error("Corrupted delta (bad varint)");
+}
+
+std::optional<std::string> encodeDelta(std::string_view reference, std::string_view target, size_t limit) {
+    const size_t common = std::min(reference.size(), target.size());
+    auto equal = [&](size_t i) { return i < common && target[i] == reference[i]; };
+
+    // unrelated data (most of the time) is rejected by looking at a few bytes, before building anything
+    constexpr size_t SAMPLES = 32;
+    if (common >= SAMPLES * 4) {
+        size_t matching = 0;
+        for (size_t i = 0; i < SAMPLES; i++) {
+            matching += equal(i * common / SAMPLES);
+        }
+        if (matching < SAMPLES / 4) {
+            return std::nullopt;
+        }
+    }
+
+    std::string delta;
+    for (size_t i = 0; i < target.size();) {
+        size_t same = 0;
+        while (equal(i + same)) {
+            same++;
+        }
+
+        // the replaced bytes go on until MIN_SAME equal bytes in a row (or the end of the target),
+        // shorter equal runs are cheaper to write again than to split the bytes around them
+        const size_t start = i + same;
+        size_t end = start;
+        while (end < target.size()) {
+            if (!equal(end)) {
+                end++;
+                continue;
+            }
+
+            size_t run = 1;
+            while (run < MIN_SAME && equal(end + run)) {
+                run++;
+            }
+
+            if (run == MIN_SAME || end + run == target.size()) {
+                break;
+            }
+            end += run;
+        }
+
+        s_putVarint(delta, same);
+        s_putVarint(delta, end - start);
+        delta.append(target.substr(start, end - start));
+        if (delta.size() > limit) {
+            return std::nullopt;
+        }
+        i = end;
+    }
+
+    return delta;
+}
+
+void applyDelta(std::string_view reference, std::string_view delta, size_t length, std::ostream& out) {
+    size_t pos = 0, written = 0;
+    while (written < length) {
+        const auto same = s_getVarint(delta, pos);
+        const auto count = s_getVarint(delta, pos);
+        if (same > length - written || count > length - written - same ||
+            same > reference.size() || written > reference.size() - same || count > delta.size() - pos) {
+            throw std::runtime_error("Corrupted delta (out of bounds)");
+        }
+
+        out.write(reference.data() + written, static_cast<std::streamsize>(same));
+        out.write(delta.data() + pos, static_cast<std::streamsize>(count));
+        pos += count;
+        written += same + count;
+    }
+
+    if (pos != delta.size()) {
+        throw std::runtime_error("Corrupted delta (trailing data)");
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef BLOCK_DELTA_H
+#define BLOCK_DELTA_H
+
+#include <cstddef>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+// byte level delta of a block against a reference block (usually the input data at the same place).
+// a delta is a list of (same, count, bytes): take `same` bytes from the reference, then write the
+// `count` bytes that follow instead of the next `count` reference bytes. both numbers are varints.
+// it only handles bytes that were replaced in place, which is what small edits to binaries look like
+// (version stamps, headers, offsets), inserted / removed data is already handled by the rolling match.
+
+// returns the delta that turns reference into target, or nothing if it would be larger than limit
+// (or the two are clearly unrelated)
+std::optional<std::string> encodeDelta(std::string_view reference, std::string_view target, size_t limit);
+
+// writes the length bytes described by the delta, throws if it doesn't fit the reference
+void applyDelta(std::string_view reference, std::string_view delta, size_t length, std::ostream& out);
+
+#endif //BLOCK_DELTA_H
@@ -0,0 +1,155 @@
+#ifndef BLOCK_INDEX_H
+#define BLOCK_INDEX_H
+
+#include <cstdint>
+#include <cstddef>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// an open addressing (linear probing) hash table that maps a block hash to the input blocks having it.
+// all slots live in one contiguous array and hold the key and its first (file id, block index) inline,
+// so a lookup is usually a single probe. blocks with a duplicate key are chained in a side array.
+template <typename Key, typename Hash>
+class BlockIndex {
+public:
+    using Entry = std::pair<size_t, size_t>; // (file id, block index)
+
+private:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    struct Slot {
+        Key key{};
+        Entry entry{};
+        uint32_t next = NONE; // first chained duplicate
+        uint32_t last = NONE; // last chained duplicate
+        bool used = false;
+    };
+
+    struct Link {
+        Entry entry;
+        uint32_t next;
+    };
+
+public:
+    explicit BlockIndex(size_t expected = 0) {
+        size_t capacity = 16;
+        while (capacity < expected * 2) {
+            capacity *= 2;
+        }
+        slots.resize(capacity);
+        mask = capacity - 1;
+    }
+
+    void insert(const Key& key, size_t file, size_t index) {
+        if ((count + 1) * 2 > slots.size()) {
+            grow();
+        }
+
+        Slot& slot = probe(slots, mask, key);
+        if (!slot.used) {
+            slot = {
+                .key = key,
+                .entry = {file, index},
+                .next = NONE,
+                .last = NONE,
+                .used = true,
+            };
+            count++;
+            return;
+        }
+
+        // duplicate key .. chain it after the others so entries stay in insertion order
+        if (chain.size() >= NONE) {
+            throw std::length_error("BlockIndex: too many duplicate blocks");
+        }
+
+        const auto link = static_cast<uint32_t>(chain.size());
+        chain.push_back({.entry = {file, index}, .next = NONE});
+        if (slot.last == NONE) {
+            slot.next = link;
+        } else {
+            chain[slot.last].next = link;
+        }
+        slot.last = link;
+    }
+
+    class Iterator {
+    public:
+        Iterator(const BlockIndex* index, const Slot* slot, uint32_t link) : index(index), slot(slot), link(link) {}
+
+        const Entry& operator*() const { return slot ? slot->entry : index->chain[link].entry; }
+        const Entry* operator->() const { return &**this; }
+
+        Iterator& operator++() {
+            link = slot ? slot->next : index->chain[link].next;
+            slot = nullptr;
+            return *this;
+        }
+
+        bool operator==(const Iterator& other) const { return slot == other.slot && link == other.link; }
+        bool operator!=(const Iterator& other) const { return !(*this == other); }
+
+    private:
+        const BlockIndex* index;
+        const Slot* slot;  // the inline entry, or nullptr once we moved to the chain
+        uint32_t link;
+    };
+
+    class Range {
+    public:
+        Range(const BlockIndex* index, const Slot* slot) : index(index), slot(slot) {}
+
+        [[nodiscard]] bool empty() const { return slot == nullptr; }
+        [[nodiscard]] Iterator begin() const { return slot ? Iterator(index, slot, NONE) : end(); }
+        [[nodiscard]] Iterator end() const { return Iterator(index, nullptr, NONE); }
+
+    private:
+        const BlockIndex* index;
+        const Slot* slot;
+    };
+
+    // all the blocks with this key (empty if none)
+    [[nodiscard]] Range find(const Key& key) const {
+        const Slot& slot = probe(slots, mask, key);
+        return Range(this, slot.used ? &slot : nullptr);
+    }
+
+    [[nodiscard]] size_t size() const { return count; }
+
+private:
+    // spread the bits of the key hash (fibonacci hashing) so that keys with weak
+    // low bits (like the rolling checksum) don't all end up in the same region
+    static size_t home(const Key& key, size_t mask) {
+        return (static_cast<uint64_t>(Hash{}(key)) * 0x9E3779B97F4A7C15ull >> 20) & mask;
+    }
+
+    // the slot that has this key, or the empty slot where it should go
+    template <typename Slots>
+    static auto& probe(Slots& slots, size_t mask, const Key& key) {
+        size_t i = home(key, mask);
+        while (slots[i].used && !(slots[i].key == key)) {
+            i = (i + 1) & mask;
+        }
+        return slots[i];
+    }
+
+    void grow() {
+        std::vector<Slot> bigger(slots.size() * 2);
+        const size_t biggerMask = bigger.size() - 1;
+        for (auto& it : slots) {
+            if (it.used) {
+                probe(bigger, biggerMask, it.key) = std::move(it);
+            }
+        }
+        slots = std::move(bigger);
+        mask = biggerMask;
+    }
+
+    std::vector<Slot> slots;
+    std::vector<Link> chain;
+    size_t mask = 0;
+    size_t count = 0;
+};
+
+#endif //BLOCK_INDEX_H
@@ -0,0 +1,29 @@
+#include "block_verifier.h"
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+#include <tuple>
+
+std::vector<bool> BlockVerifier::verify(const std::vector<Check> &checks, const Expected &expected) {
+    std::vector<size_t> sorted(checks.size());
+    std::iota(sorted.begin(), sorted.end(), 0);
+    std::sort(sorted.begin(), sorted.end(), [&](size_t a, size_t b) {
+        return std::tie(checks[a].file, checks[a].offset) < std::tie(checks[b].file, checks[b].offset);
+    });
+
+    // long ranges are compared a piece at a time (so an unmapped file doesn't need a huge buffer)
+    constexpr size_t PIECE_SIZE = 1024 * 1024;
+    std::vector<bool> results(checks.size());
+    for (const auto i: sorted) {
+        const auto &it = checks[i];
+        bool equal = true;
+        for (size_t done = 0; equal && done < it.length; done += PIECE_SIZE) {
+            const auto length = std::min(PIECE_SIZE, it.length - done);
+            const auto data = inputs.read(it.file, it.offset + done, length);
+            equal = data.size() == length && data == expected(i, done, length);
+        }
+        results[i] = equal;
+    }
+    return results;
+}
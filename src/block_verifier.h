@@ -0,0 +1,34 @@
+#ifndef BLOCK_VERIFIER_H
+#define BLOCK_VERIFIER_H
+
+#include <functional>
+#include <string_view>
+#include <vector>
+
+#include "file_table.h"
+#include "file_utils.h"
+
+// compares ranges of the input files with the data they are expected to hold
+class BlockVerifier {
+public:
+    struct Check {
+        size_t file;
+        size_t offset;
+        size_t length;
+    };
+
+    // returns the expected data of [offset, offset + length) of checks[check]
+    using Expected = std::function<std::string_view(size_t check, size_t offset, size_t length)>;
+
+    explicit BlockVerifier(const FileTable& files)
+        : inputs([&files](size_t file) { return files.path(file); }, FileView::RANDOM) {}
+
+    // verifies many ranges at once, sorted by (file, offset) so every input file is read sequentially
+    // (once) instead of jumping between files. results[i] is the result of checks[i]
+    std::vector<bool> verify(const std::vector<Check>& checks, const Expected& expected);
+
+private:
+    OpenFiles inputs;
+};
+
+#endif //BLOCK_VERIFIER_H
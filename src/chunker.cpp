@@ -0,0 +1,70 @@
+#include "chunker.h"
+
+#include <array>
+#include <stdexcept>
+
+// a fixed table of random values, one per byte value (splitmix64, so it's the same on every machine)
+static constexpr std::array<uint64_t, 256> s_gearTable() {
+    std::array<uint64_t, 256> table{};
+    uint64_t state = 0x5643545f43444321ULL;
+    for (auto &it: table) {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        it = z ^ (z >> 31);
+    }
+    return table;
+}
+
+static constexpr auto GEAR = s_gearTable();
+
+// the gear hash is shifted left each byte, so only its top bits depend on the whole (64 byte) window
+static uint64_t s_topBitsMask(unsigned bits) {
+    return bits == 0 ? 0 : ~0ULL << (64 - bits);
+}
+
+Chunker::Chunker(size_t minSize, size_t avgSize, size_t maxSize) : min(minSize), avg(avgSize), max(maxSize) {
+    if (min == 0 || min > avg || avg > max) {
+        throw std::invalid_argument("Invalid chunk sizes, expected 0 < min <= avg <= max");
+    }
+
+    unsigned bits = 0;
+    while ((size_t{1} << (bits + 1)) <= avg) {
+        bits++;
+    }
+
+    smallMask = s_topBitsMask(bits + 2);
+    largeMask = s_topBitsMask(bits > 2 ? bits - 2 : 0);
+}
+
+size_t Chunker::cut(const char *data, size_t length) const {
+    if (length <= min) {
+        return length;
+    }
+
+    if (length > max) {
+        length = max;
+    }
+
+    const size_t normal = length < avg ? length : avg;
+    const auto bytes = reinterpret_cast<const uint8_t *>(data);
+    uint64_t hash = 0;
+
+    // nothing before min can be a cut point, so there is no need to hash it
+    size_t i = min;
+    for (; i < normal; i++) {
+        hash = (hash << 1) + GEAR[bytes[i]];
+        if (!(hash & smallMask)) {
+            return i + 1;
+        }
+    }
+
+    for (; i < length; i++) {
+        hash = (hash << 1) + GEAR[bytes[i]];
+        if (!(hash & largeMask)) {
+            return i + 1;
+        }
+    }
+
+    return length;
+}
@@ -0,0 +1,32 @@
+#ifndef CHUNKER_H
+#define CHUNKER_H
+
+#include <cstdint>
+#include <cstddef>
+
+// content defined chunking (FastCDC): a gear hash is rolled over the data and a chunk ends wherever
+// its top bits are all zero, so the cut points depend on the content only .. an insertion / deletion
+// only changes the chunks around it, everything after it is still split the same way.
+// cut points are harder to hit before the average size and easier after it (normalized chunking)
+// which keeps most chunks close to the average size.
+class Chunker {
+public:
+    Chunker(size_t minSize, size_t avgSize, size_t maxSize);
+
+    // returns the length of the chunk starting at data, length is the number of available bytes,
+    // it must be at least maxSize unless data reaches the end of the file
+    [[nodiscard]] size_t cut(const char* data, size_t length) const;
+
+    [[nodiscard]] size_t minSize() const { return min; }
+    [[nodiscard]] size_t avgSize() const { return avg; }
+    [[nodiscard]] size_t maxSize() const { return max; }
+
+private:
+    size_t min;
+    size_t avg;
+    size_t max;
+    uint64_t smallMask; // used before the average size (more bits -> less likely to cut)
+    uint64_t largeMask; // used after it
+};
+
+#endif //CHUNKER_H
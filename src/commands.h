@@ -17,4 +17,21 @@
 // this file is complete .. no more copying or blocks
 #define DONE ((char) 0x04)
 
+// copy x bytes starting at an arbitrary offset of a specific file
+// followed by: file id (size_t), offset (size_t), length (size_t)
+#define COPY_RANGE ((char) 0x05)
+
+// write the following x bytes (x < block size) as is
+// followed by: length (size_t), then the bytes
+#define WRITE_BYTES ((char) 0x06)
+
+// write x bytes (x <= block size) as a delta against a range of an input file, see block_delta.h
+// followed by: file id (size_t), offset (size_t), reference length (size_t),
+// output length (size_t), delta length (size_t), then the delta
+#define DELTA_BLOCK ((char) 0x07)
+
+// write x bytes, each is the byte at the same place of a range of an input file plus a difference (mod 256)
+// followed by: file id (size_t), offset (size_t), length (size_t), then the x differences
+#define DIFF_RANGE ((char) 0x08)
+
 #endif //COMMANDS_H
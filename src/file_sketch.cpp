@@ -0,0 +1,75 @@
+#include <algorithm>
+#include <set>
+#include "file_sketch.h"
+#include "file_utils.h"
+
+static constexpr size_t WINDOW_SIZE = 16;
+
+// the rolling hash alone has poor low bits, this spreads it over the whole range (splitmix64)
+static uint64_t s_mix(uint64_t value) {
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+    return value ^ (value >> 31);
+}
+
+FileSketch sketchFile(const fs::path& path, size_t k) {
+    FileView file(path, FileView::SEQUENTIAL);
+    if (!file.isOpen() || file.size() < WINDOW_SIZE) {
+        return {};
+    }
+
+    // polynomial hash of the window, rolled one byte at a time
+    constexpr uint64_t BASE = 0x100000001B3ULL;
+    uint64_t outFactor = 1; // BASE ^ WINDOW_SIZE, to remove the byte leaving the window
+    for (size_t i = 0; i < WINDOW_SIZE; i++) {
+        outFactor *= BASE;
+    }
+
+    std::set<uint64_t> smallest;
+    uint64_t hash = 0;
+    char window[WINDOW_SIZE] = {};
+    size_t position = 0;
+
+    constexpr size_t READ_SIZE = 1024 * 1024;
+    for (size_t offset = 0; offset < file.size(); offset += READ_SIZE) {
+        const auto data = file.read(offset, READ_SIZE);
+        for (const char c: data) {
+            auto &out = window[position % WINDOW_SIZE];
+            hash = hash * BASE + static_cast<unsigned char>(c) - static_cast<unsigned char>(out) * outFactor;
+            out = c;
+            if (++position < WINDOW_SIZE) {
+                continue;
+            }
+
+            // only the values that would enter the sketch pay for the set
+            const auto value = s_mix(hash);
+            if (smallest.size() < k) {
+                smallest.insert(value);
+            } else if (value < *smallest.rbegin() && smallest.insert(value).second) {
+                smallest.erase(std::prev(smallest.end()));
+            }
+        }
+    }
+
+    return {smallest.begin(), smallest.end()};
+}
+
+double sketchSimilarity(const FileSketch& a, const FileSketch& b) {
+    // the k smallest values of the union are a random sample of it, the shared ones estimate the similarity
+    const size_t k = std::max(a.size(), b.size());
+    size_t i = 0, j = 0, taken = 0, shared = 0;
+    while (taken < k && i < a.size() && j < b.size()) {
+        if (a[i] == b[j]) {
+            shared++;
+            i++;
+            j++;
+        } else if (a[i] < b[j]) {
+            i++;
+        } else {
+            j++;
+        }
+        taken++;
+    }
+
+    return taken == 0 ? 0 : static_cast<double>(shared) / static_cast<double>(taken);
+}
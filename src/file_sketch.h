@@ -0,0 +1,21 @@
+#ifndef FILE_SKETCH_H
+#define FILE_SKETCH_H
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// bottom-k MinHash of a file: the k smallest (distinct) hashes of all its 16 byte strings, sorted.
+// two sketches estimate how much content two files share (jaccard similarity of their strings)
+// without reading them again, it doesn't matter where in the files the content is.
+using FileSketch = std::vector<uint64_t>;
+
+// reads the whole file once, empty if it can't be read or is shorter than a string
+FileSketch sketchFile(const fs::path& path, size_t k = 128);
+
+// the estimated jaccard similarity (0 .. 1) of the files the two sketches came from
+double sketchSimilarity(const FileSketch& a, const FileSketch& b);
+
+#endif //FILE_SKETCH_H
@@ -0,0 +1,190 @@
+#include "file_table.h"
+
+#include <stdexcept>
+
+#include "thread_pool.h"
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+FileTable::FileTable(fs::path root) : root(std::move(root)) {
+    directories.push_back({NONE, 0, 0});
+}
+
+uint32_t FileTable::addEntry(std::vector<Entry> &table, uint32_t parent, std::string_view name) {
+    if (names.size() + name.size() > UINT32_MAX || table.size() >= NONE) {
+        throw std::runtime_error("Too many files to list");
+    }
+
+    const auto offset = static_cast<uint32_t>(names.size());
+    names.append(name);
+    table.push_back({parent, offset, static_cast<uint32_t>(name.size())});
+    return static_cast<uint32_t>(table.size() - 1);
+}
+
+uint32_t FileTable::addDirectory(uint32_t parent, std::string_view name) {
+    auto key = std::to_string(parent);
+    key += '/';
+    key += name;
+
+    if (const auto it = directoryIds.find(key); it != directoryIds.end()) {
+        return it->second;
+    }
+
+    const auto id = addEntry(directories, parent, name);
+    directoryIds.emplace(std::move(key), id);
+    return id;
+}
+
+size_t FileTable::addFile(const fs::path &relativePath, size_t size, int64_t mtime) {
+    uint32_t parent = 0;
+    for (const auto &it: relativePath.parent_path()) {
+        parent = addDirectory(parent, it.string());
+    }
+
+    addEntry(files, parent, relativePath.filename().string());
+    sizes.push_back(size);
+    mtimes.push_back(mtime);
+    return files.size() - 1;
+}
+
+fs::path FileTable::entryPath(const Entry &entry) const {
+    auto path = directoryPath(entry.parent);
+    path /= std::string_view(names).substr(entry.nameOffset, entry.nameLength);
+    return path;
+}
+
+fs::path FileTable::directoryPath(uint32_t directory) const {
+    // collect the names up to the root, then join them in reverse
+    std::vector<uint32_t> chain;
+    for (auto it = directory; it != 0; it = directories[it].parent) {
+        chain.push_back(it);
+    }
+
+    fs::path path;
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+        path /= std::string_view(names).substr(directories[*it].nameOffset, directories[*it].nameLength);
+    }
+    return path;
+}
+
+fs::path FileTable::relativePath(size_t file) const {
+    return entryPath(files[file]);
+}
+
+FileTable buildFileTable(const fs::path &path, ThreadPool *pool) {
+    FileTable table(path);
+    if (!fs::is_directory(path)) {
+        return table;
+    }
+
+    struct Item {
+        std::string name;
+        bool isDirectory;
+        size_t size;
+        int64_t mtime;
+    };
+
+    // the files of a directory are only given ids once everything is listed (to keep the listing order)
+    struct PendingFile {
+        uint32_t nameOffset;
+        uint32_t nameLength;
+        size_t size;
+        int64_t mtime;
+    };
+
+    struct Listing {
+        std::vector<PendingFile> files;
+        std::vector<uint32_t> subdirectories;
+    };
+
+    // the directories are listed one level at a time, all the directories of a level in parallel
+    std::vector<Listing> listings(1);
+    std::vector<uint32_t> level = {0};
+    while (!level.empty()) {
+        std::vector<std::vector<Item> > items(level.size());
+        std::vector<fs::path> paths(level.size());
+        for (size_t i = 0; i < level.size(); i++) {
+            paths[i] = path / table.directoryPath(level[i]);
+        }
+
+        auto list = [&items, &paths](size_t i) {
+            for (const auto &entry: fs::directory_iterator(paths[i])) {
+                // the entry caches the file type from the directory listing, so this doesn't need another stat
+                std::error_code error;
+                Item item = {
+                    .name = entry.path().filename().string(),
+                    .isDirectory = entry.is_directory(error),
+                    .size = 0,
+                    .mtime = 0,
+                };
+
+                // one stat for both the size & the mtime (file_size & last_write_time stat the file each)
+                if (!item.isDirectory) {
+#ifndef _WIN32
+                    struct stat st{};
+                    if (::stat(entry.path().c_str(), &st) == 0) {
+                        item.size = static_cast<size_t>(st.st_size);
+                        item.mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+                    }
+#else
+                    item.size = entry.file_size(error);
+                    if (error) item.size = 0;
+                    const auto mtime = entry.last_write_time(error);
+                    item.mtime = error ? 0 : static_cast<int64_t>(mtime.time_since_epoch().count());
+#endif
+                }
+
+                items[i].push_back(std::move(item));
+            }
+        };
+
+        for (size_t i = 0; i < level.size(); i++) {
+            if (pool) {
+                pool->submit([&list, i] { list(i); });
+            } else {
+                list(i);
+            }
+        }
+
+        if (pool) {
+            pool->wait();
+        }
+
+        std::vector<uint32_t> next;
+        for (size_t i = 0; i < level.size(); i++) {
+            for (auto &item: items[i]) {
+                if (item.isDirectory) {
+                    const auto id = table.addEntry(table.directories, level[i], item.name);
+                    listings.emplace_back();
+                    listings[level[i]].subdirectories.push_back(id);
+                    next.push_back(id);
+                    continue;
+                }
+
+                const auto offset = static_cast<uint32_t>(table.names.size());
+                table.names += item.name;
+                listings[level[i]].files.push_back({offset, static_cast<uint32_t>(item.name.size()), item.size, item.mtime});
+            }
+        }
+
+        level = std::move(next);
+    }
+
+    // the files ids: the files of a directory first, then the content of its sub directories (depth first)
+    auto assign = [&](auto &self, uint32_t directory) -> void {
+        for (const auto &it: listings[directory].files) {
+            table.files.push_back({directory, it.nameOffset, it.nameLength});
+            table.sizes.push_back(it.size);
+            table.mtimes.push_back(it.mtime);
+        }
+
+        for (const auto &it: listings[directory].subdirectories) {
+            self(self, it);
+        }
+    };
+    assign(assign, 0);
+
+    return table;
+}
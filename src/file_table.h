@@ -0,0 +1,61 @@
+#ifndef FILE_TABLE_H
+#define FILE_TABLE_H
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+class ThreadPool;
+
+// a flat table of every file & directory under a root folder. each entry only keeps its name (in a shared
+// string pool) and the index of its parent directory, full paths are rebuilt on demand. the files get ids
+// 0 .. fileCount() - 1 in listing order (a folder's files first, then the content of its sub folders).
+class FileTable {
+public:
+    explicit FileTable(fs::path root = {});
+
+    // adds a file (and any missing parent directory) by its relative path, returns the file id
+    size_t addFile(const fs::path& relativePath, size_t size, int64_t mtime);
+
+    [[nodiscard]] size_t fileCount() const { return files.size(); }
+    [[nodiscard]] fs::path path(size_t file) const { return root / relativePath(file); }
+    [[nodiscard]] fs::path relativePath(size_t file) const;
+    [[nodiscard]] size_t size(size_t file) const { return sizes[file]; }
+    [[nodiscard]] int64_t mtime(size_t file) const { return mtimes[file]; }
+
+private:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    struct Entry {
+        uint32_t parent;       // index into directories (the root is directory 0, it has no parent)
+        uint32_t nameOffset;   // into names
+        uint32_t nameLength;
+    };
+
+    uint32_t addDirectory(uint32_t parent, std::string_view name);
+    uint32_t addEntry(std::vector<Entry>& table, uint32_t parent, std::string_view name);
+    [[nodiscard]] fs::path directoryPath(uint32_t directory) const;
+    [[nodiscard]] fs::path entryPath(const Entry& entry) const;
+
+    fs::path root;
+    std::string names;
+    std::vector<Entry> directories;
+    std::vector<Entry> files;
+    std::vector<size_t> sizes;
+    std::vector<int64_t> mtimes;
+    // (parent, name) -> directory, only used while adding files
+    std::unordered_map<std::string, uint32_t> directoryIds;
+
+    friend FileTable buildFileTable(const fs::path& path, ThreadPool* pool);
+};
+
+// lists every file under path, the directories of each level are listed in parallel if a pool is given
+// (the ids are the same either way). returns an empty table if path isn't a directory
+FileTable buildFileTable(const fs::path& path, ThreadPool* pool = nullptr);
+
+#endif //FILE_TABLE_H
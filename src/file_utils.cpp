@@ -7,224 +7,358 @@
 #include <vector>
 #include <iomanip>
 #include <openssl/evp.h>
+#include <openssl/opensslv.h>
+#include "xxhash.h"
 #include <cstring>
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <stdexcept>
 #include "file_utils.h"
+#include "rolling_checksum.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+FileView::FileView(const fs::path &path, Access access) {
+#ifndef _WIN32
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        struct stat st{};
+        if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+            opened = true;
+            length = static_cast<size_t>(st.st_size);
+        }
 
+        if (opened && length > 0) {
+            void* addr = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED) {
+                mapped = static_cast<char*>(addr);
+                ::madvise(addr, length, access == SEQUENTIAL ? MADV_SEQUENTIAL : MADV_RANDOM);
+            }
+        }
 
-std::string sha256(const char* input, size_t length) {
-    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
-    if (!ctx) {
-        throw std::runtime_error("Failed to create EVP_MD_CTX");
+        // the mapping stays valid after the descriptor is closed
+        ::close(fd);
+        if (mapped || length == 0) {
+            return;
+        }
     }
+#endif
 
-    if (EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr) != 1) {
-        EVP_MD_CTX_free(ctx);
-        throw std::runtime_error("EVP_DigestInit_ex failed");
+    // fallback: streaming reads
+    stream.open(path, std::ios::binary | std::ios::ate);
+    opened = static_cast<bool>(stream);
+    if (opened) {
+        length = static_cast<size_t>(stream.tellg());
     }
+}
 
-    if (EVP_DigestUpdate(ctx, input, length) != 1) {
-        EVP_MD_CTX_free(ctx);
-        throw std::runtime_error("EVP_DigestUpdate failed");
+FileView::~FileView() {
+#ifndef _WIN32
+    if (mapped) {
+        ::munmap(mapped, length);
     }
+#endif
+}
 
-    unsigned char hash[EVP_MAX_MD_SIZE];
-    unsigned int hashLen;
-    if (EVP_DigestFinal_ex(ctx, hash, &hashLen) != 1) {
-        EVP_MD_CTX_free(ctx);
-        throw std::runtime_error("EVP_DigestFinal_ex failed");
+std::string_view FileView::read(size_t offset, size_t count) {
+    if (offset >= length) {
+        return {};
     }
 
-    EVP_MD_CTX_free(ctx);
-
-    std::ostringstream hashString;
-    for (unsigned int i = 0; i < hashLen; i++) {
-        hashString << std::hex << std::setw(2) << std::setfill('0') << (int)hash[i];
+    count = std::min(count, length - offset);
+    if (mapped) {
+        return {mapped + offset, count};
     }
-    return hashString.str();
+
+    buffer.resize(count);
+    stream.clear();
+    stream.seekg(static_cast<std::streamoff>(offset), std::ios::beg);
+    stream.read(buffer.data(), static_cast<std::streamsize>(count));
+    return {buffer.data(), static_cast<size_t>(stream.gcount())};
 }
 
-std::string sha256File(const std::string& filename) {
-    std::ifstream file(filename, std::ios::binary);
-    if (!file) {
-        throw std::runtime_error("Cannot open file: " + filename);
+FileView &OpenFiles::get(size_t file) {
+    if (const auto it = open.find(file); it != open.end()) {
+        order.splice(order.begin(), order, it->second.second);
+        return *it->second.first;
     }
 
-    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
-    if (!ctx) {
-        throw std::runtime_error("Failed to create EVP_MD_CTX");
+    const auto path = pathOf(file);
+    auto view = std::make_unique<FileView>(path, access);
+    if (!view->isOpen()) {
+        throw std::runtime_error("Cannot open file: " + path.string());
     }
 
-    if (EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr) != 1) {
-        EVP_MD_CTX_free(ctx);
-        throw std::runtime_error("EVP_DigestInit_ex failed");
+    if (open.size() >= MAX_OPEN_FILES) {
+        open.erase(order.back());
+        order.pop_back();
     }
 
-    std::vector<char> buffer(8192);
-    while (file.read(buffer.data(), buffer.size()) || file.gcount()) {
-        if (EVP_DigestUpdate(ctx, buffer.data(), file.gcount()) != 1) {
-            EVP_MD_CTX_free(ctx);
-            throw std::runtime_error("EVP_DigestUpdate failed");
-        }
-    }
+    order.push_front(file);
+    auto &entry = open[file] = {std::move(view), order.begin()};
+    return *entry.first;
+}
 
-    unsigned char hash[EVP_MAX_MD_SIZE];
-    unsigned int hashLen;
-    if (EVP_DigestFinal_ex(ctx, hash, &hashLen) != 1) {
-        EVP_MD_CTX_free(ctx);
-        throw std::runtime_error("EVP_DigestFinal_ex failed");
+void OpenFiles::close(size_t file) {
+    if (const auto it = open.find(file); it != open.end()) {
+        order.erase(it->second.second);
+        open.erase(it);
     }
+}
 
-    EVP_MD_CTX_free(ctx);
-
-    std::ostringstream hashString;
-    for (unsigned int i = 0; i < hashLen; i++) {
-        hashString << std::hex << std::setw(2) << std::setfill('0') << (int)hash[i];
+std::string toHex(const Digest& digest) {
+    static constexpr char HEX[] = "0123456789abcdef";
+    std::string hex(digest.size() * 2, '0');
+    for (size_t i = 0; i < digest.size(); i++) {
+        hex[i * 2] = HEX[digest[i] >> 4];
+        hex[i * 2 + 1] = HEX[digest[i] & 0xf];
     }
-    return hashString.str();
+    return hex;
 }
 
-bool validateEqual(const fs::path &a, const fs::path &b) {
-    std::ifstream f1(a, std::ios::binary);
-    std::ifstream f2(b, std::ios::binary);
+HashType parseHashType(const std::string& name) {
+    if (name == "sha256") return HashType::SHA256;
+    if (name == "sha512-256") return HashType::SHA512_256;
+    if (name == "blake2s256") return HashType::BLAKE2S256;
+    if (name == "xxh3-128") return HashType::XXH3_128;
+    throw std::invalid_argument("Unknown hash: " + name);
+}
 
-    if (!f1 || !f2) {
-        std::cerr << "Error opening files.\n";
-        return false;
+std::string hashTypeName(HashType type) {
+    switch (type) {
+        case HashType::SHA512_256: return "sha512-256";
+        case HashType::BLAKE2S256: return "blake2s256";
+        case HashType::XXH3_128: return "xxh3-128";
+        default: return "sha256";
     }
+}
 
-    f1.seekg(0, std::ios::end);
-    f2.seekg(0, std::ios::end);
-    if (f1.tellg() != f2.tellg()) {
-        std::cout << "size didn't match" << std::endl;
-        return false;
+static const EVP_MD* s_md(HashType type) {
+#if OPENSSL_VERSION_MAJOR >= 3
+    // fetched once, EVP_sha256() & co make every init look the implementation up again
+    static const EVP_MD* sha256Md = EVP_MD_fetch(nullptr, "SHA256", nullptr);
+    static const EVP_MD* sha512_256Md = EVP_MD_fetch(nullptr, "SHA512-256", nullptr);
+    static const EVP_MD* blake2s256Md = EVP_MD_fetch(nullptr, "BLAKE2S-256", nullptr);
+#else
+    static const EVP_MD* sha256Md = EVP_sha256();
+    static const EVP_MD* sha512_256Md = EVP_sha512_256();
+    static const EVP_MD* blake2s256Md = EVP_blake2s256();
+#endif
+
+    const EVP_MD* md;
+    switch (type) {
+        case HashType::SHA512_256: md = sha512_256Md; break;
+        case HashType::BLAKE2S256: md = blake2s256Md; break;
+        default: md = sha256Md; break;
     }
 
-    f1.seekg(0, std::ios::beg);
-    f2.seekg(0, std::ios::beg);
-
-    constexpr size_t BUFFER_SIZE = 1024 * 32;
-    char buffer1[BUFFER_SIZE], buffer2[BUFFER_SIZE];
+    if (!md) {
+        throw std::runtime_error("Hash not supported by openssl: " + hashTypeName(type));
+    }
+    return md;
+}
 
-    while (true) {
-        f1.read(buffer1, BUFFER_SIZE);
-        f2.read(buffer2, BUFFER_SIZE);
-        if (std::memcmp(buffer1, buffer2, std::min(BUFFER_SIZE, static_cast<size_t>(f1.gcount()))) != 0) {
-            std::cout << "Buffer didn't match" << std::endl;
-            return false;
+// a running hash of any type, the openssl digests go through an EVP context, xxh3 keeps its own state
+class Hasher {
+public:
+    explicit Hasher(HashType type) : type(type) {
+        if (type == HashType::XXH3_128) {
+            state.reset(XXH3_createState());
+            if (!state) {
+                throw std::runtime_error("Failed to create XXH3 state");
+            }
+        } else {
+            ctx.reset(EVP_MD_CTX_new());
+            if (!ctx || EVP_DigestInit_ex(ctx.get(), s_md(type), nullptr) != 1) {
+                throw std::runtime_error("Failed to create EVP_MD_CTX");
+            }
         }
+        reset();
+    }
 
-        if (f1.eof() && f2.eof()) {
-            return true;
+    // starts over with the same hash type
+    void reset() {
+        const bool ok = state ? XXH3_128bits_reset(state.get()) == XXH_OK : EVP_DigestInit_ex(ctx.get(), nullptr, nullptr) == 1;
+        if (!ok) {
+            throw std::runtime_error("Failed to reset " + hashTypeName(type));
         }
+    }
 
-        if (f1.eof() || f2.eof()) {
-            return false;
+    void update(const char* data, size_t length) {
+        const bool ok = state ? XXH3_128bits_update(state.get(), data, length) == XXH_OK : EVP_DigestUpdate(ctx.get(), data, length) == 1;
+        if (!ok) {
+            throw std::runtime_error("Failed to hash with " + hashTypeName(type));
         }
     }
-}
 
-bool validateBlockEqual(const fs::path &a, const fs::path &b, std::streampos offset, size_t blockSize) {
-    std::ifstream f1(a, std::ios::binary);
-    std::ifstream f2(b, std::ios::binary);
+    Digest digest() {
+        Digest hash{};
+        if (state) {
+            s_canonical(XXH3_128bits_digest(state.get()), hash);
+        } else if (EVP_DigestFinal_ex(ctx.get(), hash.data(), nullptr) != 1) {
+            throw std::runtime_error("Failed to hash with " + hashTypeName(type));
+        }
+        return hash;
+    }
 
-    if (!f1 || !f2) {
-        std::cerr << "Error opening files.\n";
-        return false;
+    // xxh3 is only 16 bytes, the rest of the digest stays zero
+    static void s_canonical(XXH128_hash_t value, Digest& hash) {
+        XXH128_canonical_t canonical;
+        XXH128_canonicalFromHash(&canonical, value);
+        std::memcpy(hash.data(), canonical.digest, sizeof(canonical.digest));
     }
 
-    f1.seekg(offset, std::ios::beg);
-    f2.seekg(offset, std::ios::beg);
+private:
+    HashType type;
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> ctx{nullptr, EVP_MD_CTX_free};
+    std::unique_ptr<XXH3_state_t, decltype(&XXH3_freeState)> state{nullptr, XXH3_freeState};
+};
 
-    auto buffer1 = new char[blockSize];
-    auto buffer2 = new char[blockSize];
+// a hasher per thread & hash type. blocks are hashed hundreds of millions of times,
+// allocating a context for each of them shows up in profiles
+static Hasher& s_hasher(HashType type) {
+    thread_local std::array<std::unique_ptr<Hasher>, 4> hashers;
 
-    f1.read(buffer1, blockSize);
-    f2.read(buffer2, blockSize);
+    auto& hasher = hashers[static_cast<size_t>(type)];
+    if (!hasher) {
+        hasher = std::make_unique<Hasher>(type);
+    }
+    return *hasher;
+}
 
-    bool areEqual = (f1.gcount() == f2.gcount()) && (std::memcmp(buffer1, buffer2, f1.gcount()) == 0);
+Digest sha256(const char* input, size_t length) {
+    return hashBuffer(HashType::SHA256, input, length);
+}
 
-    delete[] buffer1;
-    delete[] buffer2;
+Digest hashBuffer(HashType type, const char* input, size_t length) {
+    if (type == HashType::XXH3_128) {
+        Digest hash{};
+        Hasher::s_canonical(XXH3_128bits(input, length), hash);
+        return hash;
+    }
 
-    return areEqual;
+    auto& hasher = s_hasher(type);
+    hasher.reset();
+    hasher.update(input, length);
+    return hasher.digest();
 }
 
-void sha256FileBlocks(const std::string &filename, size_t blockSize, std::vector<BlockHash> &blocks) {
-    std::ifstream file(filename, std::ios::binary);
-    if (!file) {
+Digest hashFile(HashType type, const std::string& filename) {
+    FileView file(filename, FileView::SEQUENTIAL);
+    if (!file.isOpen()) {
         throw std::runtime_error("Cannot open file: " + filename);
     }
 
-    std::vector<char> buffer(blockSize);
-    while (file.read(buffer.data(), static_cast<long>(blockSize)) || file.gcount()) {
-        auto readCount = file.gcount();
-        while (readCount != blockSize && !file.eof()) {
-            file.read(buffer.data() + readCount, static_cast<long>(blockSize) - readCount); // try to fill the entire buffer
-        }
-
-        auto hash = sha256(buffer.data(), readCount);
-        BlockHash blockHash = {
-            .path = filename,
-            .index = blocks.size(),
-            .hash = hash
-        };
-
-        blocks.push_back(blockHash);
+    Hasher hasher(type);
+    constexpr size_t READ_SIZE = 1024 * 1024;
+    for (size_t offset = 0; offset < file.size(); offset += READ_SIZE) {
+        const auto data = file.read(offset, READ_SIZE);
+        hasher.update(data.data(), data.size());
     }
+
+    return hasher.digest();
 }
 
+bool validateEqual(const fs::path &a, const fs::path &b) {
+    FileView f1(a, FileView::SEQUENTIAL);
+    FileView f2(b, FileView::SEQUENTIAL);
 
-static std::shared_ptr<fTreeNode> s_buildFileTreeRecv(const fs::path& path, const fs::path& relativePath) {
-    if (!fs::exists(path) || !fs::is_directory(path)) {
-        return nullptr;
+    if (!f1.isOpen() || !f2.isOpen()) {
+        std::cerr << "Error opening files.\n";
+        return false;
     }
 
-    auto rootNode = std::make_shared<fTreeNode>(path, relativePath, true);
-    for (const auto& entry : fs::directory_iterator(path)) {
-        if (entry.is_directory()) {
-            rootNode->children.push_back(s_buildFileTreeRecv(entry.path(), relativePath / rootNode->path.filename()));
-        } else {
-            rootNode->children.push_back(std::make_shared<fTreeNode>(entry.path(), relativePath / entry.path().filename(), false));
+    if (f1.size() != f2.size()) {
+        std::cout << "size didn't match" << std::endl;
+        return false;
+    }
+
+    constexpr size_t BUFFER_SIZE = 1024 * 1024;
+    for (size_t offset = 0; offset < f1.size(); offset += BUFFER_SIZE) {
+        if (f1.read(offset, BUFFER_SIZE) != f2.read(offset, BUFFER_SIZE)) {
+            std::cout << "Buffer didn't match" << std::endl;
+            return false;
         }
     }
 
-    return rootNode;
+    return true;
 }
 
-std::shared_ptr<fTreeNode> buildFileTree(const fs::path& path) {
-    if (!fs::exists(path) || !fs::is_directory(path)) {
-        return nullptr;
+Digest hashFileBlocks(HashType type, const std::string &filename, size_t blockSize, std::vector<BlockHash> &blocks) {
+    FileView file(filename, FileView::SEQUENTIAL);
+    if (!file.isOpen()) {
+        throw std::runtime_error("Cannot open file: " + filename);
     }
 
-    auto rootNode = std::make_shared<fTreeNode>(path, "__INPUT_ROOT__", true);
-
-    for (const auto& entry : fs::directory_iterator(path)) {
-        if (fs::is_directory(entry)) {
-            rootNode->children.push_back(s_buildFileTreeRecv(entry.path(), ""));
-        } else {
-            rootNode->children.push_back(std::make_shared<fTreeNode>(entry.path(), entry.path().filename(), false));
+    // the file is only read once, every block goes to both the file hasher and its own block hasher
+    Hasher fileHasher(type);
+    Hasher& blockHasher = s_hasher(type);
+
+    // read many blocks at once, but always a whole number of blocks
+    constexpr size_t READ_SIZE = 1024 * 1024;
+    const size_t bufferSize = std::max<size_t>(1, READ_SIZE / blockSize) * blockSize;
+    for (size_t position = 0; position < file.size(); position += bufferSize) {
+        const auto buffer = file.read(position, bufferSize);
+        const auto readCount = buffer.size();
+        fileHasher.update(buffer.data(), readCount);
+
+        for (size_t offset = 0; offset < readCount; offset += blockSize) {
+            const auto length = std::min(blockSize, readCount - offset);
+            const auto data = buffer.data() + offset;
+
+            blockHasher.reset();
+            blockHasher.update(data, length);
+
+            BlockHash blockHash = {
+                .index = blocks.size(),
+                .offset = position + offset,
+                .length = length,
+                .hash = blockHasher.digest(),
+                .weak = RollingChecksum::of(data, length),
+            };
+
+            blocks.push_back(blockHash);
         }
     }
 
-    return rootNode;
+    return fileHasher.digest();
 }
 
-// Function to display the tree structure (for debugging or viewing)
-void printTree(const std::shared_ptr<fTreeNode>& node, int level) {
-    if (node == nullptr) return;
+Digest hashFileChunks(HashType type, const std::string &filename, const Chunker &chunker, std::vector<BlockHash> &blocks) {
+    FileView file(filename, FileView::SEQUENTIAL);
+    if (!file.isOpen()) {
+        throw std::runtime_error("Cannot open file: " + filename);
+    }
 
-    // Indentation for tree structure view
-    std::string indent(level * 2, ' ');
+    Hasher fileHasher(type);
+    Hasher& blockHasher = s_hasher(type);
 
-    // Print the current node (directory or file)
-    if (node->isDirectory) {
-        std::cout << indent << "[DIR] " << node->relativePath.filename() << "\n";
-    } else {
-        std::cout << indent << "[FILE] " << node->relativePath.filename() << "\n";
-    }
+    for (size_t position = 0; position < file.size();) {
+        const auto available = file.read(position, chunker.maxSize());
+        const auto length = chunker.cut(available.data(), available.size());
+        const auto data = available.data();
 
-    // Recursively print all the children (subdirectories or files)
-    for (const auto& child : node->children) {
-        printTree(child, level + 1);
+        fileHasher.update(data, length);
+        blockHasher.reset();
+        blockHasher.update(data, length);
+
+        BlockHash blockHash = {
+            .index = blocks.size(),
+            .offset = position,
+            .length = length,
+            .hash = blockHasher.digest(),
+            .weak = 0,
+        };
+
+        blocks.push_back(blockHash);
+        position += length;
     }
-}
\ No newline at end of file
+
+    return fileHasher.digest();
+}
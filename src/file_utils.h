@@ -11,27 +11,85 @@
 #include <utility>
 #include <vector>
 #include <memory>
+#include <fstream>
+#include <functional>
+#include <list>
+#include <string_view>
+#include <unordered_map>
 
 #include "structures.h"
+#include "chunker.h"
 
 namespace fs = std::filesystem;
 
-struct fTreeNode {
-    fs::path path;
-    fs::path relativePath;
-    bool isDirectory;                // True if the node is a directory
-    std::vector<std::shared_ptr<fTreeNode>> children;  // Children nodes
+// a read only view of a file, the file is memory mapped when possible (with an access pattern hint)
+// otherwise it falls back to normal streaming reads into an internal buffer.
+class FileView {
+public:
+    enum Access { SEQUENTIAL, RANDOM };
 
-    fTreeNode(fs::path  path, fs::path  relativePath, bool isDirectory)
-    : path(std::move(path)), relativePath(std::move(relativePath)), isDirectory(isDirectory), children({}) {}
+    explicit FileView(const fs::path& path, Access access = SEQUENTIAL);
+    ~FileView();
+
+    FileView(const FileView&) = delete;
+    FileView& operator=(const FileView&) = delete;
+
+    [[nodiscard]] bool isOpen() const { return opened; }
+    [[nodiscard]] bool isMapped() const { return mapped != nullptr; }
+    [[nodiscard]] size_t size() const { return length; }
+
+    // returns the bytes [offset, offset + count) (clamped to the end of the file), the view points directly
+    // into the mapped pages, or into the internal buffer (valid until the next read) if the file isn't mapped
+    std::string_view read(size_t offset, size_t count);
+
+private:
+    bool opened = false;
+    size_t length = 0;
+    char* mapped = nullptr;
+    std::ifstream stream;
+    std::vector<char> buffer;
+};
+
+// the files that were read recently stay open (mapped) in a small LRU, so reading them again
+// doesn't cost an open / map / seek every time. files are identified by an id, pathOf gives
+// the file to open for an id. not thread safe, every thread should have its own.
+class OpenFiles {
+public:
+    OpenFiles(std::function<fs::path(size_t)> pathOf, FileView::Access access)
+        : pathOf(std::move(pathOf)), access(access) {}
+
+    // the view of a file, opened if it isn't already (throws std::runtime_error if it can't be)
+    FileView& get(size_t file);
+
+    // same as FileView::read, the view is valid until the next read
+    std::string_view read(size_t file, size_t offset, size_t length) { return get(file).read(offset, length); }
+
+    // drops the view of a file (before it gets moved or overwritten)
+    void close(size_t file);
+
+private:
+    static constexpr size_t MAX_OPEN_FILES = 64;
+
+    std::function<fs::path(size_t)> pathOf;
+    FileView::Access access;
+    std::list<size_t> order; // most recently used first
+    std::unordered_map<size_t, std::pair<std::unique_ptr<FileView>, std::list<size_t>::iterator> > open;
 };
 
-std::string sha256(const char* input, size_t length);
-std::string sha256File(const std::string& filename);
+// the hash used to identify files & blocks, all of them give a 32 bytes digest.
+// xxh3-128 isn't cryptographic, its 16 bytes are followed by zeros
+enum class HashType { SHA256, SHA512_256, BLAKE2S256, XXH3_128 };
+HashType parseHashType(const std::string& name); // throws std::invalid_argument for unknown names
+std::string hashTypeName(HashType type);
+
+std::string toHex(const Digest& digest);
+Digest sha256(const char* input, size_t length);
+Digest hashBuffer(HashType type, const char* input, size_t length);
+Digest hashFile(HashType type, const std::string& filename);
 bool validateEqual(const fs::path& a, const fs::path& b);
-bool validateBlockEqual(const fs::path& a, const fs::path& b, std::streampos offset, size_t blockSize);
-void sha256FileBlocks(const std::string& filename, size_t blockSize, std::vector<BlockHash>& blocks);
-std::shared_ptr<fTreeNode> buildFileTree(const fs::path& path);
-void printTree(const std::shared_ptr<fTreeNode>& node, int level = 0);
+// hashes the whole file and each of its blocks in a single pass, returns the whole file hash
+Digest hashFileBlocks(HashType type, const std::string& filename, size_t blockSize, std::vector<BlockHash>& blocks);
+// same as hashFileBlocks, but the file is split into content defined chunks (no weak checksums)
+Digest hashFileChunks(HashType type, const std::string& filename, const Chunker& chunker, std::vector<BlockHash>& blocks);
 
 #endif //FILE_UTILS_H
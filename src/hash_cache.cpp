@@ -0,0 +1,192 @@
+#include "hash_cache.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include "file_utils.h"
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+static constexpr char MAGIC[] = {'V', 'C', 'T', 'C', '1'};
+
+HashCache::HashCache(fs::path directory, std::string blocking, uintmax_t maxSize)
+    : directory(std::move(directory)), blocking(std::move(blocking)), maxSize(maxSize) {
+    std::error_code error;
+    fs::create_directories(this->directory, error);
+    enabled = !error && fs::is_directory(this->directory, error);
+    if (!enabled) {
+        std::cerr << "Cannot use hash cache directory: " << this->directory << std::endl;
+    }
+}
+
+std::string HashCache::key(const fs::path &root, const fs::path &relativePath) const {
+    const auto path = root / relativePath;
+
+    // a single stat, this runs for every input file (twice when it isn't cached yet)
+    unsigned long long size = 0, inode = 0;
+    long long mtime = 0;
+#ifndef _WIN32
+    struct stat st{};
+    if (::stat(path.c_str(), &st) != 0) return "";
+    size = static_cast<unsigned long long>(st.st_size);
+    mtime = static_cast<long long>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    inode = static_cast<unsigned long long>(st.st_ino);
+#else
+    std::error_code error;
+    size = fs::file_size(path, error);
+    if (error) return "";
+    mtime = fs::last_write_time(path, error).time_since_epoch().count();
+    if (error) return "";
+#endif
+
+    std::ostringstream key;
+    key << path.string() << '\n' << size << ' ' << mtime << ' ' << inode << '\n' << blocking;
+    return key.str();
+}
+
+fs::path HashCache::entryPath(const std::string &key) const {
+    return directory / toHex(sha256(key.data(), key.size()));
+}
+
+template<typename T>
+static bool s_read(std::istream &in, T &value) {
+    return static_cast<bool>(in.read(reinterpret_cast<char *>(&value), sizeof(T)));
+}
+
+template<typename T>
+static void s_write(std::ostream &out, const T &value) {
+    out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+bool HashCache::load(const std::string &key, Digest &hash, std::vector<BlockHash> &blocks) const {
+    if (!enabled || key.empty()) return false;
+
+    const auto path = entryPath(key);
+    std::error_code error;
+    const auto fileSize = fs::file_size(path, error);
+    if (error) return false;
+
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+
+    char magic[sizeof(MAGIC)];
+    size_t keyLength;
+    if (!in.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), MAGIC) ||
+        !s_read(in, keyLength) || keyLength != key.size()) {
+        return false;
+    }
+
+    // the entry name is only a hash of the key, make sure it's really this file
+    std::string storedKey(keyLength, '\0');
+    if (!in.read(storedKey.data(), static_cast<std::streamsize>(keyLength)) || storedKey != key) {
+        return false;
+    }
+
+    size_t count;
+    if (!s_read(in, hash) || !s_read(in, count)) {
+        return false;
+    }
+
+    // a corrupted count must not decide how much is allocated, the blocks are all that's left of the entry
+    constexpr size_t BLOCK_RECORD_SIZE = sizeof(BlockHash::offset) + sizeof(BlockHash::length) +
+                                         sizeof(BlockHash::hash) + sizeof(BlockHash::weak);
+    const auto position = static_cast<size_t>(in.tellg());
+    if (position > fileSize || count != (fileSize - position) / BLOCK_RECORD_SIZE) {
+        return false;
+    }
+
+    std::vector<BlockHash> loaded(count);
+    for (size_t i = 0; i < count; i++) {
+        auto &it = loaded[i];
+        it.index = i;
+        if (!s_read(in, it.offset) || !s_read(in, it.length) || !s_read(in, it.hash) || !s_read(in, it.weak)) {
+            return false;
+        }
+    }
+
+    blocks = std::move(loaded);
+
+    // the modification time is when the entry was last used, prune() removes the oldest ones
+    in.close();
+    fs::last_write_time(path, fs::file_time_type::clock::now(), error);
+    return true;
+}
+
+void HashCache::store(const std::string &key, const Digest &hash, const std::vector<BlockHash> &blocks) const {
+    if (!enabled || key.empty()) return;
+
+    // write a temporary file then rename it, so a reader never sees half an entry
+    const auto path = entryPath(key);
+    auto temp = path;
+    temp += "." + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + ".tmp";
+
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        if (!out) return;
+
+        out.write(MAGIC, sizeof(MAGIC));
+        s_write(out, key.size());
+        out.write(key.data(), static_cast<std::streamsize>(key.size()));
+        s_write(out, hash);
+        s_write(out, blocks.size());
+        for (const auto &it: blocks) {
+            s_write(out, it.offset);
+            s_write(out, it.length);
+            s_write(out, it.hash);
+            s_write(out, it.weak);
+        }
+
+        if (!out) {
+            out.close();
+            std::error_code error;
+            fs::remove(temp, error);
+            return;
+        }
+    }
+
+    std::error_code error;
+    fs::rename(temp, path, error);
+    if (error) {
+        fs::remove(temp, error);
+    }
+}
+
+void HashCache::prune() const {
+    if (!enabled) return;
+
+    struct Entry {
+        fs::path path;
+        uintmax_t size;
+        fs::file_time_type used;
+    };
+
+    std::vector<Entry> entries;
+    uintmax_t total = 0;
+    std::error_code error;
+    for (fs::directory_iterator it(directory, error), end; !error && it != end; it.increment(error)) {
+        std::error_code entryError;
+        if (!it->is_regular_file(entryError)) continue;
+
+        Entry entry{it->path(), it->file_size(entryError), {}};
+        if (entryError) continue;
+        entry.used = it->last_write_time(entryError);
+        if (entryError) continue;
+
+        total += entry.size;
+        entries.push_back(std::move(entry));
+    }
+
+    if (total <= maxSize) return;
+
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.used < b.used; });
+    for (const auto &entry: entries) {
+        if (total <= maxSize) break;
+        if (fs::remove(entry.path, error)) {
+            total -= entry.size;
+        }
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef HASH_CACHE_H
+#define HASH_CACHE_H
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "structures.h"
+
+namespace fs = std::filesystem;
+
+// a persistent cache of the input hashes (whole file + blocks), so diffing the same base tree again
+// doesn't need to read it again. an entry is only valid for the exact same file: same path, size,
+// modification time and inode, hashed with the same blocking (block size / chunking parameters).
+// every entry is its own file (named after the hash of its key) so threads never share anything.
+// the directory is kept under maxSize bytes by prune(), the least recently used entries go first.
+class HashCache {
+public:
+    // blocking describes how the files are split into blocks, entries made with another blocking are ignored
+    HashCache(fs::path directory, std::string blocking, uintmax_t maxSize);
+
+    // the key of the file in its current state, empty if it can't be stat-ed.
+    // root must be canonical (resolve it once, not for every file)
+    [[nodiscard]] std::string key(const fs::path& root, const fs::path& relativePath) const;
+
+    // true if an entry was found for this key (hash & blocks are then filled)
+    bool load(const std::string& key, Digest& hash, std::vector<BlockHash>& blocks) const;
+
+    // failures are ignored, it's only a cache
+    void store(const std::string& key, const Digest& hash, const std::vector<BlockHash>& blocks) const;
+
+    // removes the least recently used (loaded or stored) entries until the cache fits in maxSize,
+    // call it once the stores are done, failures are ignored
+    void prune() const;
+
+private:
+    [[nodiscard]] fs::path entryPath(const std::string& key) const;
+
+    fs::path directory;
+    std::string blocking;
+    uintmax_t maxSize;
+    bool enabled = false;
+};
+
+#endif //HASH_CACHE_H
@@ -8,96 +8,526 @@
 #include <vector>
 #include <sstream>
 #include <cstring>
+#include <unordered_map>
+#include <optional>
+#include <set>
+#include <map>
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <limits>
 #include "miniz.h"
-#include "env.hpp"
 #include "file_utils.h"
 #include "structures.h"
 #include "commands.h"
 #include "progress_bar.h"
+#include "rolling_checksum.h"
+#include "thread_pool.h"
+#include "block_index.h"
+#include "zip_writer.h"
+#include "chunker.h"
+#include "hash_cache.h"
+#include "env.hpp"
+#include "signature.h"
+#include "file_table.h"
+#include "block_verifier.h"
+#include "block_delta.h"
+#include "binary_diff.h"
+#include "file_sketch.h"
+
+template<typename T>
+void writeToBuffer(const T &obj, char *buffer) {
+    std::memcpy(buffer, &obj, sizeof(T));
+}
+
+// Deserialize: Read an object of type T from a buffer
+template<typename T>
+T readFromBuffer(const char *buffer) {
+    T obj;
+    std::memcpy(&obj, buffer, sizeof(T));
+    return obj;
+}
 
-bool addFileToZip(mz_zip_archive &zip, const fs::path &filePath, const fs::path &basePath) {
-    std::ifstream file(filePath, std::ios::binary | std::ios::ate);
-    if (!file) {
-        std::cerr << "Failed to open file: " << filePath << "\n";
-        return false;
+// writes the commands of a single update file, consecutive copied blocks (or byte ranges) are merged
+// into a single COPY_RANGE and raw data is split into WRITE_BLOCK / WRITE_BYTES commands
+class UpdateFileWriter {
+public:
+    UpdateFileWriter(std::ostream &out, size_t blockSize) : out(out), blockSize(blockSize) {}
+
+    // true if copying this block can be merged with the previous copy
+    [[nodiscard]] bool continues(size_t file, size_t index) const {
+        return hasCopy && copyCount > 0 && file == copyFile && index * blockSize == copyOffset + copyLength &&
+               copyLength == copyCount * blockSize;
     }
 
-    std::streamsize fileSize = file.tellg();
-    file.seekg(0, std::ios::beg);
-    std::vector<char> buffer(fileSize);
-    if (!file.read(buffer.data(), fileSize)) {
-        std::cerr << "Failed to read file: " << filePath << "\n";
-        return false;
+    // true if copying this byte range can be merged with the previous copy
+    [[nodiscard]] bool continuesAt(size_t file, size_t offset) const {
+        return hasCopy && file == copyFile && offset == copyOffset + copyLength;
     }
 
-    std::string zipPath = fs::relative(filePath, basePath).string();
+    void copyBlock(size_t file, size_t index, size_t length) {
+        if (continues(file, index)) {
+            copyCount++;
+            copyLength += length;
+            return;
+        }
 
-    if (!mz_zip_writer_add_mem(&zip, zipPath.c_str(), buffer.data(), buffer.size(), MZ_BEST_COMPRESSION)) {
-        std::cerr << "Failed to add file to ZIP: " << zipPath << "\n";
-        return false;
+        flushCopy();
+        hasCopy = true;
+        copyFile = file;
+        copyOffset = index * blockSize;
+        copyCount = 1;
+        copyLength = length;
     }
 
-    return true;
-}
+    void copyRange(size_t file, size_t offset, size_t length) {
+        if (continuesAt(file, offset)) {
+            copyCount = 0; // not whole blocks anymore
+            copyLength += length;
+            return;
+        }
 
-// Function to zip an entire folder
-bool zipFolder(const std::string &folderPath, const std::string &zipFilePath) {
-    mz_zip_archive zip = {};
+        flushCopy();
+        hasCopy = true;
+        copyFile = file;
+        copyOffset = offset;
+        copyCount = 0;
+        copyLength = length;
+    }
 
-    if (!mz_zip_writer_init_file(&zip, zipFilePath.c_str(), 0)) {
-        std::cerr << "Failed to create ZIP file: " << zipFilePath << "\n";
-        return false;
+    void write(const char *data, size_t length) {
+        if (length == 0) return;
+        flushCopy();
+
+        while (length >= blockSize) {
+            out.put(WRITE_BLOCK);
+            out.write(data, static_cast<std::streamsize>(blockSize));
+            data += blockSize;
+            length -= blockSize;
+        }
+
+        if (length > 0) {
+            out.put(WRITE_BYTES);
+            out.write(reinterpret_cast<const char *>(&length), sizeof(size_t));
+            out.write(data, static_cast<std::streamsize>(length));
+        }
     }
 
-    fs::path basePath(folderPath);
-    for (const auto &entry: fs::recursive_directory_iterator(basePath)) {
-        if (fs::is_regular_file(entry.path())) {
-            if (!addFileToZip(zip, entry.path(), basePath)) {
-                mz_zip_writer_end(&zip);
-                return false;
-            }
+    // writes data (at most a block) as a delta against [offset, offset + referenceLength) of an input file
+    void writeDelta(size_t file, size_t offset, size_t referenceLength, size_t length, const std::string &delta) {
+        flushCopy();
+        const size_t deltaLength = delta.size();
+        out.put(DELTA_BLOCK);
+        out.write(reinterpret_cast<const char *>(&file), sizeof(size_t));
+        out.write(reinterpret_cast<const char *>(&offset), sizeof(size_t));
+        out.write(reinterpret_cast<const char *>(&referenceLength), sizeof(size_t));
+        out.write(reinterpret_cast<const char *>(&length), sizeof(size_t));
+        out.write(reinterpret_cast<const char *>(&deltaLength), sizeof(size_t));
+        out.write(delta.data(), static_cast<std::streamsize>(deltaLength));
+    }
+
+    // starts a DIFF_RANGE, the length differences are then written with writeDiff (can be called in chunks)
+    void beginDiff(size_t file, size_t offset, size_t length) {
+        flushCopy();
+        out.put(DIFF_RANGE);
+        out.write(reinterpret_cast<const char *>(&file), sizeof(size_t));
+        out.write(reinterpret_cast<const char *>(&offset), sizeof(size_t));
+        out.write(reinterpret_cast<const char *>(&length), sizeof(size_t));
+    }
+
+    void writeDiff(const char *data, size_t length) {
+        out.write(data, static_cast<std::streamsize>(length));
+    }
+
+    // the bytes a DELTA_BLOCK costs on top of its delta
+    static constexpr size_t DELTA_HEADER_SIZE = sizeof(char) + sizeof(size_t) * 5;
+
+    void finish() {
+        flushCopy();
+        out.put(DONE);
+    }
+
+private:
+    void flushCopy() {
+        if (!hasCopy) return;
+        hasCopy = false;
+
+        if (copyCount == 1) {
+            const size_t index = copyOffset / blockSize;
+            out.put(COPY_BLOCK);
+            out.write(reinterpret_cast<const char *>(&copyFile), sizeof(size_t));
+            out.write(reinterpret_cast<const char *>(&index), sizeof(size_t));
+            return;
+        }
+
+        out.put(COPY_RANGE);
+        out.write(reinterpret_cast<const char *>(&copyFile), sizeof(size_t));
+        out.write(reinterpret_cast<const char *>(&copyOffset), sizeof(size_t));
+        out.write(reinterpret_cast<const char *>(&copyLength), sizeof(size_t));
+    }
+
+    std::ostream &out;
+    size_t blockSize;
+
+    bool hasCopy = false;
+    size_t copyFile = 0;
+    size_t copyOffset = 0;
+    size_t copyCount = 0;     // number of whole blocks copied (0 if it's an arbitrary byte range)
+    size_t copyLength = 0;
+};
+
+// the commands of an update file, decided before any input is read: copies are only matched by their hash and
+// get verified later (a whole batch at once, in input order). consecutive copies / writes are merged.
+struct UpdatePlan {
+    struct Command {
+        enum Type : uint8_t { COPY, WRITE, DIFF } type;
+        size_t file;     // COPY / DIFF: the input file
+        size_t offset;   // COPY / DIFF: in the input file, WRITE: in the output file
+        size_t length;
+    };
+
+    std::optional<size_t> copyFile; // the whole file is equal to this input
+    std::vector<Command> commands;
+
+    // true if copying this byte range can be merged with the previous copy
+    [[nodiscard]] bool continuesAt(size_t file, size_t offset) const {
+        return !commands.empty() && commands.back().type == Command::COPY && commands.back().file == file &&
+               commands.back().offset + commands.back().length == offset;
+    }
+
+    void copy(size_t file, size_t offset, size_t length) {
+        if (continuesAt(file, offset)) {
+            commands.back().length += length;
+        } else {
+            commands.push_back({Command::COPY, file, offset, length});
+        }
+    }
+
+    void diff(size_t file, size_t offset, size_t length) {
+        if (length == 0) return;
+        if (!commands.empty() && commands.back().type == Command::DIFF && commands.back().file == file &&
+            commands.back().offset + commands.back().length == offset) {
+            commands.back().length += length;
+        } else {
+            commands.push_back({Command::DIFF, file, offset, length});
+        }
+    }
+
+    void write(size_t offset, size_t length) {
+        if (length == 0) return;
+        if (!commands.empty() && commands.back().type == Command::WRITE &&
+            commands.back().offset + commands.back().length == offset) {
+            commands.back().length += length;
+        } else {
+            commands.push_back({Command::WRITE, 0, offset, length});
         }
     }
+};
+
+// how many of the matches found by hash are compared byte by byte with the input before they are used
+struct VerifyPolicy {
+    enum Mode { ALWAYS, NEVER, SAMPLE } mode = ALWAYS;
+    double fraction = 1;
 
-    mz_zip_writer_finalize_archive(&zip);
-    mz_zip_writer_end(&zip);
+    // the same key always gets the same answer, so the sample is the same between runs
+    [[nodiscard]] bool shouldVerify(uint64_t key) const {
+        if (mode != SAMPLE) return mode == ALWAYS;
+
+        // splitmix64, so close keys are spread over the whole range
+        key += 0x9E3779B97F4A7C15ULL;
+        key = (key ^ (key >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        key = (key ^ (key >> 27)) * 0x94D049BB133111EBULL;
+        key ^= key >> 31;
+        return static_cast<double>(key >> 11) * 0x1.0p-53 < fraction;
+    }
+};
 
-    return true;
+static VerifyPolicy parseVerifyPolicy(std::map<std::string, std::string> &args) {
+    VerifyPolicy policy;
+    if (args["-verify"] == "never") {
+        policy.mode = VerifyPolicy::NEVER;
+    } else if (args["-verify"] == "sample") {
+        policy.mode = VerifyPolicy::SAMPLE;
+        policy.fraction = std::stod(args["-verify-fraction"]);
+        if (policy.fraction < 0 || policy.fraction > 1) {
+            throw std::invalid_argument("Invalid value for option: -verify-fraction");
+        }
+    }
+    return policy;
 }
 
+// an upper bound for the size of the update file of a plan: a command header for every planned command,
+// the bytes of the raw & diffed data, and another header for every block the raw data is split into
+// (a delta is only used when it's smaller than the block it replaces)
+static size_t maxUpdateFileSize(const UpdatePlan &plan, size_t blockSize) {
+    if (plan.copyFile) {
+        return sizeof(char) * 2 + sizeof(size_t);
+    }
 
-static void bfsListFiles(const fTreeNode *root, std::vector<std::pair<fs::path, fs::path> > &paths) {
-    for (const auto &it: root->children) {
-        paths.push_back({it->path, it->relativePath});
+    constexpr size_t COMMAND_SIZE = sizeof(char) + sizeof(size_t) * 3;
+    size_t size = sizeof(char);
+    for (const auto &it: plan.commands) {
+        size += COMMAND_SIZE;
+        if (it.type == UpdatePlan::Command::WRITE) {
+            size += it.length + it.length / blockSize * COMMAND_SIZE;
+        } else if (it.type == UpdatePlan::Command::DIFF) {
+            size += it.length;
+        }
     }
+    return size;
+}
+
+// the options that control how the input files are hashed, shared by the diff & sign modes
+static void addHashingOptions(std::map<std::string, Option> &options) {
+    options["-hash"] = {
+        .type = Option::ENUM,
+        .required = false,
+        .enumValues = {"sha256", "sha512-256", "blake2s256", "xxh3-128"},
+        .desc = "the hash used to identify files & blocks (not required)"
+        "\n     \"sha256\"     -> fast on cpus with sha extensions."
+        "\n     \"sha512-256\" -> faster than sha256 on 64 bit cpus without them."
+        "\n     \"blake2s256\" -> close to sha512-256, for tools that expect blake2."
+        "\n     \"xxh3-128\"   -> by far the fastest, but not cryptographic: only for trusted inputs.",
+        .defaultValue = "sha256",
+    };
+
+    options["-bs"] = {
+        .type = Option::NUMBER,
+        .required = false,
+        .enumValues = {},
+        .desc = "the size of each block",
+        .defaultValue = "8192", // 8 KB
+    };
+
+    options["-cache"] = {
+        .type = Option::STRING,
+        .required = false,
+        .enumValues = {},
+        .desc = "folder where the input hashes are cached between runs (not required, no cache without it)",
+        .defaultValue = "",
+    };
+
+    options["-cache-size"] = {
+        .type = Option::NUMBER,
+        .required = false,
+        .enumValues = {},
+        .desc = "the most bytes the -cache folder keeps, the least recently used hashes are removed first",
+        .defaultValue = "268435456", // 256 MB
+    };
+
+    options["-chunking"] = {
+        .type = Option::ENUM,
+        .required = false,
+        .enumValues = {"fixed", "cdc"},
+        .desc = "how files are split into blocks:"
+        "\n     \"fixed\"  -> blocks of -bs bytes, matched at any offset using a rolling checksum."
+        "\n     \"cdc\"    -> content defined chunks (FastCDC) of -cdc-min .. -cdc-max bytes.",
+        .defaultValue = "fixed",
+    };
+
+    options["-cdc-min"] = {
+        .type = Option::NUMBER,
+        .required = false,
+        .enumValues = {},
+        .desc = "the minimum size of a chunk (cdc chunking only)",
+        .defaultValue = "2048", // 2 KB
+    };
+
+    options["-cdc-avg"] = {
+        .type = Option::NUMBER,
+        .required = false,
+        .enumValues = {},
+        .desc = "the average size of a chunk (cdc chunking only)",
+        .defaultValue = "8192", // 8 KB
+    };
+
+    options["-cdc-max"] = {
+        .type = Option::NUMBER,
+        .required = false,
+        .enumValues = {},
+        .desc = "the maximum size of a chunk (cdc chunking only)",
+        .defaultValue = "65536", // 64 KB
+    };
 
-    for (const auto &it: root->children) {
-        if (!it->children.empty()) {
-            bfsListFiles(it.get(), paths);
+    options["-j"] = {
+        .type = Option::NUMBER,
+        .required = false,
+        .enumValues = {},
+        .desc = "number of threads used for hashing & compression (0 -> use all cores)",
+        .defaultValue = "0",
+    };
+}
+
+struct HashingConfig {
+    HashType hash = HashType::SHA256;
+    size_t blockSize = 0;
+    size_t threads = 0;
+    // content defined chunking splits the inputs & outputs the same way, so no rolling window is needed
+    std::optional<Chunker> chunker;
+    // unchanged input files (same path, size, mtime & inode) are not hashed again
+    std::optional<HashCache> cache;
+};
+
+static HashingConfig parseHashingOptions(std::map<std::string, std::string> &args) {
+    HashingConfig config;
+    config.hash = parseHashType(args["-hash"]);
+    std::istringstream blockSizeStream(args["-bs"]);
+    blockSizeStream >> config.blockSize;
+    std::istringstream threadsStream(args["-j"]);
+    threadsStream >> config.threads;
+
+    if (args["-chunking"] == "cdc") {
+        config.chunker.emplace(std::stoul(args["-cdc-min"]), std::stoul(args["-cdc-avg"]), std::stoul(args["-cdc-max"]));
+    }
+
+    if (!args["-cache"].empty()) {
+        std::ostringstream blocking;
+        if (config.chunker) {
+            blocking << "cdc " << config.chunker->minSize() << " " << config.chunker->avgSize() << " " << config.chunker->maxSize();
+        } else {
+            blocking << "fixed " << config.blockSize;
         }
+        blocking << " " << hashTypeName(config.hash);
+        config.cache.emplace(fs::path(args["-cache"]), blocking.str(), std::stoull(args["-cache-size"]));
     }
+
+    return config;
 }
 
-template<typename T>
-void writeToBuffer(const T &obj, char *buffer) {
-    std::memcpy(buffer, &obj, sizeof(T));
+// hashes every input file (and its blocks) in parallel
+static void hashInputs(ThreadPool &pool, const HashingConfig &config, const fs::path &src_path, const FileTable &input_files,
+                       std::map<size_t, FileHash> &inputFilesHashes, std::map<size_t, std::vector<BlockHash> > &inputFilesBlocksHashes) {
+    std::cout << "Prepare Input Hashes .. ";
+    std::error_code error;
+    const auto cacheRoot = config.cache ? fs::canonical(src_path, error) : fs::path();
+    // each task only writes to its own slot, the results are then merged in order
+    std::vector<FileHash> filesHashes(input_files.fileCount());
+    std::vector<std::vector<BlockHash> > filesBlocksHashes(input_files.fileCount());
+    std::atomic<size_t> cached = 0;
+    for (size_t i = 0; i < input_files.fileCount(); i++) {
+        pool.submit([&, i] {
+            const auto path = input_files.path(i);
+            filesHashes[i].path = input_files.relativePath(i);
+
+            const auto key = config.cache && !error ? config.cache->key(cacheRoot, filesHashes[i].path) : "";
+            if (config.cache && config.cache->load(key, filesHashes[i].hash, filesBlocksHashes[i])) {
+                ++cached;
+                return;
+            }
+
+            filesHashes[i].hash = config.chunker
+                                      ? hashFileChunks(config.hash, path, *config.chunker, filesBlocksHashes[i])
+                                      : hashFileBlocks(config.hash, path, config.blockSize, filesBlocksHashes[i]);
+
+            // only cache it if the file didn't change while it was being hashed
+            if (config.cache && !key.empty() && config.cache->key(cacheRoot, filesHashes[i].path) == key) {
+                config.cache->store(key, filesHashes[i].hash, filesBlocksHashes[i]);
+            }
+        });
+    }
+
+    progress_bar::set(progress_bar::defaultBarWithTitle("Prepare Input Hashes"), input_files.fileCount());
+    pool.wait([](size_t done) { progress_bar::setProgress(done); });
+    for (size_t i = 0; i < input_files.fileCount(); i++) {
+        inputFilesHashes[i] = std::move(filesHashes[i]);
+        inputFilesBlocksHashes[i] = std::move(filesBlocksHashes[i]);
+    }
+
+    if (config.cache) {
+        config.cache->prune();
+    }
+
+    if (cached > 0) {
+        std::cout << " .. " << cached << " cached";
+    }
+    std::cout << " .. Done" << std::endl;
 }
 
-// Deserialize: Read an object of type T from a buffer
-template<typename T>
-T readFromBuffer(const char *buffer) {
-    T obj;
-    std::memcpy(&obj, buffer, sizeof(T));
-    return obj;
+// "vct sign": hashes an input tree once and writes its signature, the signature can be used
+// instead of the tree itself (-from-sig) to create v-diff files on another machine
+static int sign(int argc, char *argv[]) {
+    std::map<std::string, Option> options;
+    options["-from"] = {
+        .type = Option::STRING,
+        .required = true,
+        .enumValues = {},
+        .desc = "a path to the root of the folder to sign (required)",
+        .defaultValue = "",
+    };
+
+    options["-o"] = {
+        .type = Option::STRING,
+        .required = false,
+        .enumValues = {},
+        .desc = "where to write the signature (not required)",
+        .defaultValue = "./v-sig.bin",
+    };
+
+    addHashingOptions(options);
+    auto args = parseArgs(argc, argv, options);
+
+    const std::string src_path = args["-from"];
+    const std::string output = args["-o"];
+    const auto config = parseHashingOptions(args);
+    ThreadPool pool(config.threads);
+
+    printf("Creating signature for \"%s\"\nOutput: %s\n", src_path.c_str(), output.c_str());
+
+    std::cout << "Listing inputs .. ";
+    const auto input_files = buildFileTable(src_path, &pool);
+    std::cout << "Done" << std::endl;
+
+    std::map<size_t, FileHash> inputFilesHashes;
+    std::map<size_t, std::vector<BlockHash> > inputFilesBlocksHashes;
+    hashInputs(pool, config, src_path, input_files, inputFilesHashes, inputFilesBlocksHashes);
+
+    std::cout << "Writing Signature .. ";
+    Signature signature;
+    signature.root = fs::absolute(src_path);
+    signature.hash = config.hash;
+    signature.blockSize = config.blockSize;
+    if (config.chunker) {
+        signature.cdcMin = config.chunker->minSize();
+        signature.cdcAvg = config.chunker->avgSize();
+        signature.cdcMax = config.chunker->maxSize();
+    }
+
+    for (size_t i = 0; i < input_files.fileCount(); i++) {
+        auto &blocks = inputFilesBlocksHashes[i];
+        const size_t size = blocks.empty() ? 0 : blocks.back().offset + blocks.back().length;
+        signature.files.push_back({
+            .relativePath = input_files.relativePath(i),
+            .size = size,
+            .hash = inputFilesHashes[i].hash,
+            .blocks = std::move(blocks),
+        });
+    }
+
+    writeSignature(output, signature);
+    std::cout << "Done" << std::endl;
+
+    return 0;
 }
 
 int main(int argc, char *argv[]) {
+    if (argc > 1 && std::string(argv[1]) == "sign") {
+        return sign(argc - 1, argv + 1);
+    }
+
     std::map<std::string, Option> options;
     options["-from"] = {
         .type = Option::STRING,
-        .required = true,
+        .required = false,
+        .enumValues = {},
+        .desc = "a path to the root of the folder that contains the version you're updating from (required unless -from-sig)",
+        .defaultValue = "",
+    };
+
+    options["-from-sig"] = {
+        .type = Option::STRING,
+        .required = false,
         .enumValues = {},
-        .desc = "a path to the root of the folder that contains the version you're updating from (required)",
+        .desc = "a signature of the version you're updating from (created by \"vct sign\"), used instead of -from",
         .defaultValue = "",
     };
 
@@ -129,192 +559,869 @@ int main(int argc, char *argv[]) {
         .defaultValue = "./v-diff.zip",
     };
 
-    options["-bs"] = {
+    options["-cl"] = {
         .type = Option::NUMBER,
         .required = false,
         .enumValues = {},
-        .desc = "the size of each block",
-        .defaultValue = "8192", // 8 KB
+        .desc = "compression level of the output, 0 (store) .. 10 (slowest)",
+        .defaultValue = "9",
+    };
+
+    options["-verify"] = {
+        .type = Option::ENUM,
+        .required = false,
+        .enumValues = {"always", "never", "sample"},
+        .desc = "should matches (same size & hash) be compared byte by byte with the input ? (not required)"
+        "\n     \"always\" -> compare every copied file / block."
+        "\n     \"never\"  -> trust the hashes."
+        "\n     \"sample\" -> compare a -verify-fraction of them.",
+        .defaultValue = "always",
     };
 
+    options["-verify-fraction"] = {
+        .type = Option::NUMBER,
+        .required = false,
+        .enumValues = {},
+        .desc = "the fraction of matches compared when -verify is \"sample\" (0 .. 1)",
+        .defaultValue = "0.05",
+    };
+
+    options["-trust-mtime"] = {
+        .type = Option::BOOL,
+        .required = false,
+        .enumValues = {},
+        .desc = "an output with the same relative path, size & modification time as an input is assumed unchanged (not read at all)",
+        .defaultValue = "false",
+    };
+
+    options["-bindiff-min"] = {
+        .type = Option::NUMBER,
+        .required = false,
+        .enumValues = {},
+        .desc = "changed files of at least this size are also diffed as a whole (bsdiff) against the input at the same path"
+        "\n     (or the most similar input for renamed files),"
+        "\n     the smaller result is used, a diff that takes too long (repetitive data) is dropped. 0 to disable (not required)",
+        .defaultValue = "1048576", // 1 MB
+    };
+
+    options["-bindiff-max"] = {
+        .type = Option::NUMBER,
+        .required = false,
+        .enumValues = {},
+        .desc = "the largest input a file is diffed as a whole against, it takes 8 bytes of memory per input byte (not required)",
+        .defaultValue = "67108864", // 64 MB
+    };
+
+    addHashingOptions(options);
     auto args = parseArgs(argc, argv, options);
 
     const std::string src_path = args["-from"];
+    const std::string sig_path = args["-from-sig"];
     const std::string dst_path = args["-to"];
     const std::string vm = args["-vm"];
     const std::string output = args["-o"];
-    std::istringstream blockSizeStream(args["-bs"]);
-    size_t blockSize;
-    blockSizeStream >> blockSize;
+    std::istringstream levelStream(args["-cl"]);
+    int level;
+    levelStream >> level;
+    if (level < MZ_NO_COMPRESSION || level > MZ_UBER_COMPRESSION) {
+        throw std::invalid_argument("Invalid value for option: -cl");
+    }
 
-    std::filesystem::path cacheDir = getUniqueTempDir();
-    std::cout << "Cache directory: " << cacheDir << std::endl;
+    if (src_path.empty() == sig_path.empty()) {
+        throw std::invalid_argument("Exactly one of -from / -from-sig is required");
+    }
+
+    auto config = parseHashingOptions(args);
+    VerifyPolicy verify = parseVerifyPolicy(args);
+    const bool trustMtime = args["-trust-mtime"] == "true";
+    const size_t binaryDiffMin = std::stoull(args["-bindiff-min"]);
+    const size_t binaryDiffMax = std::min<size_t>(std::stoull(args["-bindiff-max"]), std::numeric_limits<int32_t>::max() - 1);
 
-    printf("Creating v-diff file for \"%s\" -> \"%s\", \nUsing validation: %s\nOutput: %s\n", src_path.c_str(),
+    // without the input tree its content can't be compared byte by byte, matching hashes are trusted instead
+    std::optional<Signature> signature;
+    if (!sig_path.empty()) {
+        signature = readSignature(sig_path);
+        verify.mode = VerifyPolicy::NEVER;
+        // the outputs must be split (and hashed) exactly like the inputs were
+        config.hash = signature->hash;
+        config.blockSize = signature->blockSize;
+        config.chunker.reset();
+        if (signature->cdcMax > 0) {
+            config.chunker.emplace(signature->cdcMin, signature->cdcAvg, signature->cdcMax);
+        }
+    }
+
+    const size_t blockSize = config.blockSize;
+    const auto &chunker = config.chunker;
+    const auto hashType = config.hash;
+
+    ThreadPool pool(config.threads);
+
+    printf("Creating v-diff file for \"%s\" -> \"%s\", \nUsing validation: %s\nOutput: %s\n", signature ? sig_path.c_str() : src_path.c_str(),
            dst_path.c_str(), vm.c_str(), output.c_str());
 
-    // build input tree
+    // the archive is written directly, the update files are streamed into it as they are created
+    // (small ones are compressed on the pool, in parallel)
+    ZipWriter zip(output, level, &pool);
 
-    std::cout << "Listing inputs .. ";
-    auto input_tree = buildFileTree(src_path);
-    std::vector<std::pair<fs::path, fs::path> > input_files;
-    bfsListFiles(input_tree.get(), input_files); // list all files (using bfs) and set a file index as it's id
-    std::cout << "Done" << std::endl;
+    // everything needed to read the update files back
+    std::ostringstream meta_file;
+    meta_file << "block_size " << blockSize << std::endl;
+    meta_file << "hash " << hashTypeName(hashType) << std::endl;
+    if (chunker) {
+        meta_file << "chunking cdc " << chunker->minSize() << " " << chunker->avgSize() << " " << chunker->maxSize() << std::endl;
+    }
+    zip.add("meta", meta_file.str());
 
-    // prepare inputs hashes
-    std::cout << "Prepare Input Hashes .. ";
+    // build input tree
+    FileTable input_files;
     std::map<size_t, FileHash> inputFilesHashes;
     std::map<size_t, std::vector<BlockHash> > inputFilesBlocksHashes;
-    for (const auto& i : progress_bar::ranged<long>(0, input_files.size() - 1, 1, "Prepare Input Hashes")) {
-        const auto &path = input_files[i];
-        inputFilesHashes[i] = {
-            .path = path.second,
-            .hash = sha256File(path.first),
-        };
+    if (signature) {
+        input_files = FileTable(signature->root);
+        for (auto &it: signature->files) {
+            const auto id = input_files.addFile(it.relativePath, it.size, 0);
+            inputFilesHashes[id] = {.path = it.relativePath, .hash = it.hash};
+            inputFilesBlocksHashes[id] = std::move(it.blocks);
+        }
+    } else {
+        std::cout << "Listing inputs .. ";
+        input_files = buildFileTable(src_path, &pool);
+        std::cout << "Done" << std::endl;
 
-        std::vector<BlockHash> fileBlocksHashes;
-        sha256FileBlocks(path.first, blockSize, fileBlocksHashes);
-        inputFilesBlocksHashes[i] = fileBlocksHashes;
+        hashInputs(pool, config, src_path, input_files, inputFilesHashes, inputFilesBlocksHashes);
     }
-    std::cout << " .. Done" << std::endl;
-
 
     // write hashes in a file for validation
     if (vm == "all" || vm == "input") {
         std::cout << "Input validation is enabled. building input validation file." << std::endl;
-        auto iv = cacheDir / "iv";
-        std::ofstream iv_file(iv);
+        std::ostringstream iv_file;
         for (const auto &it: progress_bar::from(inputFilesHashes, inputFilesHashes.size() - 1, "Input Hashes")) {
-            iv_file << it.second.path << " " << it.second.hash << std::endl;
+            iv_file << it.second.path << " " << toHex(it.second.hash) << std::endl;
         }
-        iv_file.close();
+        zip.add("iv", iv_file.str());
         std::cout << " .. Done" << std::endl;
     }
 
     // write input list ids
-    std::ofstream input_listing_file(cacheDir / "input_list");
-    for (const auto &path: progress_bar::from(input_files, input_files.size() - 1, "Write Input IDS")) {
-        input_listing_file << path.first << " " << path.second << std::endl;
+    std::ostringstream input_listing_file;
+    for (const auto &i: progress_bar::ranged<long>(0, input_files.fileCount() - 1, 1, "Write Input IDS")) {
+        input_listing_file << input_files.path(i) << " " << input_files.relativePath(i) << std::endl;
     }
     std::cout << " .. Done" << std::endl;
-    input_listing_file.close();
+    zip.add("input_list", input_listing_file.str());
 
     // build the output files tree
     std::cout << "Listing outputs .. ";
-    auto output_tree = buildFileTree(dst_path);
-    std::vector<std::pair<fs::path, fs::path> > output_files;
-    bfsListFiles(output_tree.get(), output_files); // list all files (using bfs) and set a file index as it's id
+    const auto output_files = buildFileTable(dst_path, &pool);
     std::cout << "Done" << std::endl;
 
+    // most files keep their relative path between versions, so each output is first paired with the input at the
+    // same path. if both have the same size (and content) it's written as a COPY_FILE right away
+    std::map<fs::path, size_t> invertedInputList; // each (relative) path can only have one file so it's ok
+    for (size_t i = 0; i < input_files.fileCount(); i++) {
+        invertedInputList[input_files.relativePath(i)] = i;
+    }
+
     // list all outputs hashes
     std::cout << "Prepare Output Hashes .. ";
     std::map<size_t, FileHash> outputFilesHashes;
-    std::map<size_t, std::vector<BlockHash> > outputFilesBlocksHashes;
-    for (const auto& i : progress_bar::ranged<long>(0, output_files.size() - 1, 1, "Prepare Output Hashes")) {
-        const auto &path = output_files[i];
-        outputFilesHashes[i] = {
-            .path = path.second,
-            .hash = sha256File(path.first),
-        };
+    std::vector<std::optional<size_t> > unchangedFiles(output_files.fileCount()); // the input each output is equal to
+    {
+        // no need for the output blocks hashes, the output is matched using a rolling window instead
+        std::vector<FileHash> filesHashes(output_files.fileCount());
+        for (size_t i = 0; i < output_files.fileCount(); i++) {
+            pool.submit([&, i] {
+                filesHashes[i].path = output_files.relativePath(i);
+
+                std::optional<size_t> paired;
+                if (const auto it = invertedInputList.find(filesHashes[i].path); it != invertedInputList.end() &&
+                    input_files.size(it->second) == output_files.size(i)) {
+                    paired = it->second;
+                }
 
-        std::vector<BlockHash> fileBlocksHashes;
-        sha256FileBlocks(path.first, blockSize, fileBlocksHashes);
-        outputFilesBlocksHashes[i] = fileBlocksHashes;
+                // same metadata: don't even read it, it has the input's hash
+                if (paired && trustMtime && input_files.mtime(*paired) != 0 &&
+                    input_files.mtime(*paired) == output_files.mtime(i)) {
+                    filesHashes[i].hash = inputFilesHashes.at(*paired).hash;
+                    unchangedFiles[i] = paired;
+                    return;
+                }
+
+                filesHashes[i].hash = hashFile(hashType, output_files.path(i));
+                if (paired && inputFilesHashes.at(*paired).hash == filesHashes[i].hash &&
+                    (!verify.shouldVerify(i) || validateEqual(input_files.path(*paired), output_files.path(i)))) {
+                    unchangedFiles[i] = paired;
+                }
+            });
+        }
+
+        progress_bar::set(progress_bar::defaultBarWithTitle("Prepare Output Hashes"), output_files.fileCount());
+        pool.wait([](size_t done) { progress_bar::setProgress(done); });
+        for (size_t i = 0; i < output_files.fileCount(); i++) {
+            outputFilesHashes[i] = std::move(filesHashes[i]);
+        }
     }
     std::cout << " .. Done" << std::endl;
 
+    // the input each changed output is delta encoded / binary diffed against: the input at the same path, or for
+    // new (renamed / moved) outputs the input that lost its output and shares the most content with it. the content
+    // is compared with MinHash sketches, only files on one side of a rename are sketched (and never with a signature,
+    // the inputs can't be read)
+    constexpr double MIN_SIMILARITY = 0.1;
+    std::vector<std::optional<size_t> > referenceInputs(output_files.fileCount());
+    if (!signature) {
+        std::set<fs::path> outputPaths;
+        std::vector<size_t> renamedOutputs;
+        for (size_t i = 0; i < output_files.fileCount(); i++) {
+            outputPaths.insert(output_files.relativePath(i));
+            if (const auto it = invertedInputList.find(output_files.relativePath(i)); it != invertedInputList.end()) {
+                referenceInputs[i] = it->second;
+            } else {
+                renamedOutputs.push_back(i);
+            }
+        }
+
+        std::vector<size_t> orphanInputs;
+        for (size_t i = 0; i < input_files.fileCount(); i++) {
+            if (!outputPaths.contains(input_files.relativePath(i))) {
+                orphanInputs.push_back(i);
+            }
+        }
+
+        if (!renamedOutputs.empty() && !orphanInputs.empty()) {
+            std::cout << "Pairing Renamed Files .. ";
+            std::vector<FileSketch> inputSketches(orphanInputs.size()), outputSketches(renamedOutputs.size());
+            for (size_t d = 0; d < orphanInputs.size(); d++) {
+                pool.submit([&, d] { inputSketches[d] = sketchFile(input_files.path(orphanInputs[d])); });
+            }
+            for (size_t o = 0; o < renamedOutputs.size(); o++) {
+                pool.submit([&, o] { outputSketches[o] = sketchFile(output_files.path(renamedOutputs[o])); });
+            }
+
+            progress_bar::set(progress_bar::defaultBarWithTitle("Pairing Renamed Files"),
+                              static_cast<long long>(orphanInputs.size() + renamedOutputs.size()));
+            pool.wait([](size_t done) { progress_bar::setProgress(done); });
+
+            // every sketch value points to the inputs that have it (lsh with single value bands), so an output is
+            // only compared with the inputs it shares values with
+            std::unordered_map<uint64_t, std::vector<size_t> > inputsOf;
+            for (size_t d = 0; d < orphanInputs.size(); d++) {
+                for (const auto value: inputSketches[d]) {
+                    inputsOf[value].push_back(d);
+                }
+            }
+
+            size_t pairedCount = 0;
+            for (size_t o = 0; o < renamedOutputs.size(); o++) {
+                std::unordered_map<size_t, size_t> shared;
+                for (const auto value: outputSketches[o]) {
+                    if (const auto it = inputsOf.find(value); it != inputsOf.end()) {
+                        for (const auto d: it->second) {
+                            shared[d]++;
+                        }
+                    }
+                }
+
+                std::optional<size_t> best;
+                double bestSimilarity = MIN_SIMILARITY;
+                for (const auto &[d, count]: shared) {
+                    const auto similarity = sketchSimilarity(outputSketches[o], inputSketches[d]);
+                    if (similarity >= bestSimilarity && (!best || similarity > bestSimilarity || d < *best)) {
+                        best = d;
+                        bestSimilarity = similarity;
+                    }
+                }
+
+                if (best) {
+                    referenceInputs[renamedOutputs[o]] = orphanInputs[*best];
+                    pairedCount++;
+                }
+            }
+            std::cout << " .. " << pairedCount << " paired .. Done" << std::endl;
+        }
+    }
+
     // created inverted hash map to search for output hashes inside the inputs quickly
     std::cout << "Prepare Inverted Index .. ";
-    std::map<fs::path, size_t> invertedInputList; // each (relative) path can only have one file so it's ok
-    std::map<std::string, std::vector<size_t> > invertedFilesHashes;
+    std::unordered_map<Digest, std::vector<size_t>, DigestHash> invertedFilesHashes;
     // more than one file can have the same hash .. its hard to happen .. but possible
-    std::map<std::string, std::vector<std::pair<size_t, size_t> > > invertedBlocksHashes;
+    size_t inputBlocksCount = 0;
+    for (const auto &it: inputFilesBlocksHashes) {
+        inputBlocksCount += it.second.size();
+    }
+    BlockIndex<Digest, DigestHash> invertedBlocksHashes(inputBlocksCount);
     // more than one block can have the same hash
-    for (const auto& i : progress_bar::ranged<long>(0, output_files.size() - 1, 1, "Prepare Inverted Index")) {
-        const auto &path = input_files[i];
-        invertedInputList[path.second] = i;
+    BlockIndex<uint32_t, std::hash<uint32_t> > invertedWeakHashes(chunker ? 0 : inputBlocksCount);
+    // the weak (rolling) checksums collide a lot more, they are only used to find candidates
+    for (const auto& i : progress_bar::ranged<long>(0, input_files.fileCount() - 1, 1, "Prepare Inverted Index")) {
         invertedFilesHashes[inputFilesHashes[i].hash].emplace_back(i);
         for (const auto &it: inputFilesBlocksHashes[i]) {
-            invertedBlocksHashes[it.hash].emplace_back(static_cast<size_t>(i), it.index);
+            invertedBlocksHashes.insert(it.hash, i, it.index);
+            if (!chunker) {
+                invertedWeakHashes.insert(it.weak, i, it.index);
+            }
             //direct the hash to the index-th block in the i-th file
         }
     }
     std::cout << " .. Done" << std::endl;
 
-    std::cout << "Writing Update Files .. " << std::endl;
-    const auto rootDir = cacheDir / "data";
-    fs::create_directories(rootDir);
-    constexpr size_t WRITER_BUFFER_SIZE = 64 * 1024;
-    auto writer_buffer = new char[WRITER_BUFFER_SIZE];
-    for (const auto& i : progress_bar::ranged<long>(0, output_files.size() - 1, 1, "Writing Update Files")) {
-        std::ofstream file_writer(rootDir / output_files[i].second);
-        std::ifstream file_reader(output_files[i].first, std::ios::binary);
-        const auto &path = output_files[i];
-        const auto &hash = outputFilesHashes[i];
-        const auto &blockHashes = outputFilesBlocksHashes[i];
+    auto blockOf = [&](const std::pair<size_t, size_t> &block) -> const BlockHash & {
+        return inputFilesBlocksHashes.at(block.first)[block.second];
+    };
+
+    // decides how to write an output file, the copies are checked by their hashes only.
+    // the files are planned on the pool, so nothing shared is modified here
+    constexpr size_t WINDOW_READ_SIZE = 64 * 1024;
+    auto planFile = [&](size_t i) {
+        UpdatePlan plan;
+        const auto path = output_files.path(i);
+        const auto &hash = outputFilesHashes.at(i);
 
         // option 1: try to find a file with the exact hash and check if it actually equal to this file .. if so then just copy it
-        const auto &matchingFiles = invertedFilesHashes[hash.hash];
-        bool write_complete = false;
-        for (const auto &it: matchingFiles) {
-            if (validateEqual(input_files[it].first, path.first)) {
+        // (the sizes are known from the listing, so files of another size are never opened)
+        if (unchangedFiles[i]) {
+            // the input at the same path, already checked while hashing
+            plan.copyFile = unchangedFiles[i];
+            return plan;
+        }
+
+        static const std::vector<size_t> NO_FILES;
+        const auto found = invertedFilesHashes.find(hash.hash);
+        for (const auto &it: found == invertedFilesHashes.end() ? NO_FILES : found->second) {
+            if (input_files.size(it) != output_files.size(i)) {
+                continue;
+            }
+
+            if (!verify.shouldVerify(i) || validateEqual(input_files.path(it), path)) {
                 // these two files are the exact same :) ... good news we only need to reference this
                 // input file in the update file
-                writeToBuffer(COPY_FILE, writer_buffer);
-                writeToBuffer(it, writer_buffer + sizeof(char));
-                writeToBuffer(DONE, writer_buffer + sizeof(char) + sizeof(size_t));
-                file_writer.write(writer_buffer, sizeof(char) * 2 + sizeof(size_t));
-                write_complete = true;
+                plan.copyFile = it;
+                return plan;
+            }
+        }
+
+        // true if the input block (file, index) has the same hash as the given data
+        auto confirm = [&](const std::pair<size_t, size_t> &block, const Digest &strong, size_t length) {
+            const auto &it = blockOf(block);
+            return it.hash == strong && it.length == length;
+        };
+
+        auto findBlock = [&](const auto &candidates, const Digest &strong, size_t length) -> std::optional<std::pair<size_t, size_t> > {
+            // prefer the block right after the last copied one, so both copies are merged into one range
+            for (const auto &it: candidates) {
+                if (plan.continuesAt(it.first, blockOf(it).offset) && confirm(it, strong, length)) {
+                    return it;
+                }
+            }
+
+            for (const auto &it: candidates) {
+                if (!plan.continuesAt(it.first, blockOf(it).offset) && confirm(it, strong, length)) {
+                    return it;
+                }
+            }
+
+            return std::nullopt;
+        };
+
+        // option 2 (cdc): split the file into chunks exactly like the inputs were split, then each chunk is
+        // either found in the inputs by its hash or written as is. the cut points follow the content, so
+        // data that got shifted by an insertion / deletion is still split into the same chunks
+        if (chunker) {
+            FileView view(path, FileView::SEQUENTIAL);
+            for (size_t position = 0; position < view.size();) {
+                const auto available = view.read(position, chunker->maxSize());
+                const auto length = chunker->cut(available.data(), available.size());
+                const auto strong = hashBuffer(hashType, available.data(), length);
+
+                const auto candidates = invertedBlocksHashes.find(strong);
+                if (const auto match = candidates.empty() ? std::nullopt : findBlock(candidates, strong, length)) {
+                    plan.copy(match->first, blockOf(*match).offset, length);
+                } else {
+                    plan.write(position, length);
+                }
+                position += length;
+            }
+
+            return plan;
+        }
+
+        // option 2 (fixed): slide a block sized window over the file one byte at a time and try to match it with
+        // any input block, the rolling checksum finds the candidates and the strong hash confirms them. this way
+        // content that got shifted by an insertion / deletion can still be copied from the input
+        std::ifstream file_reader(path, std::ios::binary);
+
+        // the window always holds the pending raw data [lit, pos) (less than a block) and the block [pos, pos + blockSize)
+        // window[0] is at offset base of the file
+        const size_t capacity = blockSize * 2 + WINDOW_READ_SIZE;
+        std::vector<char> window(capacity);
+        size_t base = 0, lit = 0, pos = 0, end = 0;
+        bool eof = false;
+
+        // make sure that [pos, pos + needed) is loaded (unless the file ended)
+        auto fill = [&](size_t needed) {
+            while (end - pos < needed && !eof) {
+                if (lit > 0) {
+                    std::memmove(window.data(), window.data() + lit, end - lit);
+                    base += lit;
+                    pos -= lit;
+                    end -= lit;
+                    lit = 0;
+                }
+
+                file_reader.read(window.data() + end, static_cast<std::streamsize>(capacity - end));
+                end += file_reader.gcount();
+                eof = !file_reader;
+            }
+        };
+
+        RollingChecksum checksum;
+        bool rolled = false; // is the checksum valid for the block at pos ?
+        while (true) {
+            fill(blockSize);
+            if (end - pos < blockSize) {
                 break;
             }
+
+            if (!rolled) {
+                checksum.reset(window.data() + pos, blockSize);
+                rolled = true;
+            }
+
+            if (const auto candidates = invertedWeakHashes.find(checksum.digest()); !candidates.empty()) {
+                const auto strong = hashBuffer(hashType, window.data() + pos, blockSize);
+                if (const auto match = findBlock(candidates, strong, blockSize)) {
+                    plan.write(base + lit, pos - lit);
+                    plan.copy(match->first, blockOf(*match).offset, blockSize);
+                    pos += blockSize;
+                    lit = pos;
+                    rolled = false;
+                    continue;
+                }
+            }
+
+            // no match .. move the window one byte forward
+            fill(blockSize + 1);
+            if (end - pos > blockSize) {
+                checksum.roll(window[pos], window[pos + blockSize]);
+            } else {
+                rolled = false;
+            }
+            pos++;
+
+            if (pos - lit == blockSize) {
+                // was unable to find any block from the input that can be copied to the output .. then just dumb the entire thing
+                plan.write(base + lit, blockSize);
+                lit = pos;
+            }
         }
 
-        if (write_complete) {
-            file_writer.close();
-            file_reader.close();
-            continue;
-        }
-
-        // option 2: go block by block .. and try to match each block
-        for (const auto &blockHash: blockHashes) {
-            const auto &matchingBlocks = invertedBlocksHashes[blockHash.hash];
-            bool block_write_complete = false;
-            for (const auto &it: matchingBlocks) {
-                const auto &matchedFilePath = input_files[it.first].first;
-                if (validateBlockEqual(matchedFilePath, path.first, it.second * blockSize, blockSize)) {
-                    // block is indeed equal .. write command to copy it
-                    writeToBuffer(COPY_BLOCK, writer_buffer);
-                    writeToBuffer(it.first, writer_buffer + sizeof(char));
-                    writeToBuffer(it.second, writer_buffer + sizeof(char) + sizeof(size_t));
-                    // no done here .. done indicates the end of a file
-                    file_writer.write(writer_buffer, sizeof(char) + sizeof(size_t) * 2);
-                    block_write_complete = true;
-                    break;
+        // the tail of the file (shorter than a block) can only match the last block of an input file
+        if (pos < end) {
+            const auto strong = hashBuffer(hashType, window.data() + pos, end - pos);
+            if (const auto candidates = invertedBlocksHashes.find(strong); !candidates.empty()) {
+                if (const auto match = findBlock(candidates, strong, end - pos)) {
+                    plan.write(base + lit, pos - lit);
+                    plan.copy(match->first, blockOf(*match).offset, end - pos);
+                    lit = end;
                 }
             }
+        }
 
-            if (block_write_complete) {
-                continue;
+        plan.write(base + lit, end - lit);
+        return plan;
+    };
+
+    // option 3: a large file that changed is also diffed as a whole against its reference input. it's used
+    // instead of the plan when it has less raw data: the extra bytes plus the differences that aren't 0
+    // (the zeros compress to almost nothing). needs the input data, so never when diffing against a signature
+    // the diffs run on the pool with the rest of the planning, the ones that don't fit in the memory left wait
+    constexpr size_t MAX_DIFF_MEMORY = 1024ull * 1024 * 1024; // 1 GB
+    MemoryBudget diffMemory(MAX_DIFF_MEMORY);
+    auto planBinaryDiff = [&](size_t i, const UpdatePlan &plan) -> std::optional<UpdatePlan> {
+        if (plan.copyFile || signature || binaryDiffMin == 0 || output_files.size(i) < binaryDiffMin) {
+            return std::nullopt;
+        }
+
+        const auto reference = referenceInputs[i];
+        if (!reference || input_files.size(*reference) == 0 || input_files.size(*reference) > binaryDiffMax) {
+            return std::nullopt;
+        }
+
+        size_t planCost = 0;
+        for (const auto &it: plan.commands) {
+            planCost += it.type == UpdatePlan::Command::WRITE ? it.length : 0;
+        }
+        if (planCost == 0) {
+            return std::nullopt;
+        }
+
+        // the suffix array takes 8 bytes per input byte, the gram filter & a copy of the input (not mapped) 2 more
+        const MemoryBudget::Reservation memory(diffMemory, input_files.size(*reference) * 10);
+
+        FileView oldFile(input_files.path(*reference), FileView::RANDOM);
+        FileView newFile(output_files.path(i), FileView::RANDOM);
+        if (!oldFile.isOpen() || !newFile.isOpen()) {
+            return std::nullopt;
+        }
+        // a streamed (not mapped) view only keeps the last read, so the input is copied aside then
+        std::string oldCopy;
+        std::string_view oldData = oldFile.read(0, oldFile.size());
+        if (!oldFile.isMapped()) {
+            oldCopy = oldData;
+            oldData = oldCopy;
+        }
+        const auto newData = newFile.read(0, newFile.size());
+
+        // the raw data of the plan is mostly new (not in the input at all): skip the expensive part
+        const GramFilter grams(oldData);
+        size_t sampled = 0, covered = 0;
+        for (const auto &it: plan.commands) {
+            for (size_t k = 0; it.type == UpdatePlan::Command::WRITE && k + GramFilter::GRAM_SIZE <= it.length; k += 64) {
+                sampled++;
+                covered += grams.mayContain(newData.data() + it.offset + k);
             }
+        }
+        if (covered * 2 < sampled) {
+            return std::nullopt;
+        }
+
+        // long ranges that came out exactly equal are copied, the differences are only written around them
+        constexpr size_t MIN_COPY_SIZE = 1024;
+        constexpr size_t COMMAND_SIZE = sizeof(char) + sizeof(size_t) * 3;
+        UpdatePlan diffPlan;
+        size_t diffCost = 0, position = 0;
+        // the diff of a file gets 2 seconds plus one for every 4 MB, the block plan is kept if it takes longer
+        constexpr size_t BYTES_PER_SECOND = 4 * 1024 * 1024;
+        const auto seconds = 2 + (oldData.size() + newData.size()) / BYTES_PER_SECOND;
+        const auto controls = binaryDiff(oldData, newData, grams, std::chrono::steady_clock::now() + std::chrono::seconds(seconds));
+        if (!controls) {
+            return std::nullopt;
+        }
+
+        for (const auto &it: *controls) {
+            for (size_t k = 0; k < it.diffLength;) {
+                size_t same = 0;
+                while (k + same < it.diffLength && newData[position + k + same] == oldData[it.oldOffset + k + same]) {
+                    same++;
+                }
 
-            // was unable to find any block from the input that can be copied to the output .. then just dumb the entire thing
-            writeToBuffer(WRITE_BLOCK, writer_buffer);
-            file_writer.write(writer_buffer, sizeof(char));
-            size_t r = blockSize;
-            file_reader.seekg(blockHash.index * blockSize, std::ios::beg);
-            while (r > 0 && !file_reader.eof()) {
-                file_reader.read(writer_buffer, std::min<size_t>(r, WRITER_BUFFER_SIZE));
-                file_writer.write(writer_buffer, file_reader.gcount());
-                r -= file_reader.gcount();
+                if (same >= MIN_COPY_SIZE || same == it.diffLength) {
+                    diffPlan.copy(*reference, it.oldOffset + k, same);
+                    diffCost += COMMAND_SIZE;
+                    k += same;
+                    continue;
+                }
+
+                // differences go on until the next run of equal bytes that is worth a copy
+                size_t end = k + same, run = 0;
+                for (; end < it.diffLength && run < MIN_COPY_SIZE; end++) {
+                    const bool equal = newData[position + end] == oldData[it.oldOffset + end];
+                    run = equal ? run + 1 : 0;
+                    diffCost += !equal;
+                }
+                if (run == MIN_COPY_SIZE) {
+                    end -= MIN_COPY_SIZE;
+                }
+
+                diffPlan.diff(*reference, it.oldOffset + k, end - k);
+                diffCost += COMMAND_SIZE;
+                k = end;
             }
+
+            diffPlan.write(position + it.diffLength, it.extraLength);
+            diffCost += it.extraLength + COMMAND_SIZE;
+            position += it.diffLength + it.extraLength;
+        }
+
+        if (diffCost >= planCost) {
+            return std::nullopt;
+        }
+        return diffPlan;
+    };
+
+    // the outputs are handled in batches: plan every file of the batch, verify all of its copies in one sweep
+    // sorted by input file & offset (sequential reads instead of jumping around the input tree), then write them
+    std::cout << "Writing Update Files .. " << std::endl;
+    constexpr size_t MAX_BATCH_SIZE = 256 * 1024 * 1024;
+    constexpr size_t WRITER_BUFFER_SIZE = 64 * 1024;
+    auto writer_buffer = new char[WRITER_BUFFER_SIZE];
+    BlockVerifier verifier(input_files); // keeps the recently used input files open between batches
+    OpenFiles outputs([&](size_t i) { return output_files.path(i); }, FileView::RANDOM);
+    OpenFiles references([&](size_t i) { return input_files.path(i); }, FileView::RANDOM); // the inputs the raw data is delta encoded against
+    progress_bar::set(progress_bar::defaultBarWithTitle("Writing Update Files"), output_files.fileCount());
+    for (size_t first = 0; first < output_files.fileCount();) {
+        size_t last = first, batchSize = 0;
+        while (last < output_files.fileCount() && (last == first || batchSize + output_files.size(last) <= MAX_BATCH_SIZE)) {
+            batchSize += output_files.size(last++);
+        }
+
+        // every file of the batch is planned on the pool
+        std::vector<std::future<UpdatePlan> > planned;
+        for (size_t i = first; i < last; i++) {
+            auto task = std::make_shared<std::packaged_task<UpdatePlan()> >([&, i] {
+                auto plan = planFile(i);
+                if (auto diffPlan = planBinaryDiff(i, plan)) {
+                    plan = std::move(*diffPlan);
+                }
+                return plan;
+            });
+            planned.push_back(task->get_future());
+            pool.submit([task] { (*task)(); });
+        }
+
+        // all of them finish before a failure is rethrown, the tasks use the locals of this function
+        std::vector<UpdatePlan> plans;
+        for (auto &it: planned) {
+            it.wait();
+        }
+        for (auto &it: planned) {
+            plans.push_back(it.get());
         }
 
-        writeToBuffer(DONE, writer_buffer);
-        file_writer.write(writer_buffer, sizeof(char));
-        file_reader.close();
-        file_writer.close();
+        if (verify.mode != VerifyPolicy::NEVER) {
+            // a copy that fails is split into the input blocks it was matched with, each block is then checked
+            // against the next input blocks with the same hash (a sweep per attempt) before it's written as is
+            constexpr size_t MAX_ATTEMPTS = 4;
+            struct Copy {
+                size_t plan;
+                size_t command;
+                size_t position; // in the output file
+                size_t length;
+                std::vector<std::pair<size_t, size_t> > sources; // (input file, offset) to check, in order
+                size_t attempt = 0;
+                bool verified = false;
+            };
 
-        std::cout << "\r" << " >> " << path.first << std::endl;
+            auto verifyAttempts = [&](const std::vector<Copy *> &pending) {
+                std::vector<BlockVerifier::Check> checks;
+                for (const auto *it: pending) {
+                    const auto &[file, offset] = it->sources[it->attempt];
+                    checks.push_back({file, offset, it->length});
+                }
+
+                const auto results = verifier.verify(checks, [&](size_t check, size_t offset, size_t length) {
+                    return outputs.read(first + pending[check]->plan, pending[check]->position + offset, length);
+                });
+                for (size_t c = 0; c < pending.size(); c++) {
+                    pending[c]->verified = results[c];
+                }
+            };
+
+            std::vector<Copy> copies;
+            for (size_t p = 0; p < plans.size(); p++) {
+                size_t position = 0;
+                for (size_t c = 0; c < plans[p].commands.size(); c++) {
+                    const auto &it = plans[p].commands[c];
+                    if (it.type == UpdatePlan::Command::COPY && verify.shouldVerify((first + p) ^ (position << 24))) {
+                        copies.push_back({p, c, position, it.length, {{it.file, it.offset}}});
+                    }
+                    position += it.length;
+                }
+            }
+
+            std::vector<Copy *> pending;
+            for (auto &it: copies) {
+                pending.push_back(&it);
+            }
+            verifyAttempts(pending);
+
+            std::vector<Copy> pieces;
+            for (const auto &copy: copies) {
+                if (copy.verified) continue;
+
+                const auto &command = plans[copy.plan].commands[copy.command];
+                const auto &blocks = inputFilesBlocksHashes.at(command.file);
+                auto block = std::upper_bound(blocks.begin(), blocks.end(), command.offset, [](size_t offset, const BlockHash &it) {
+                    return offset < it.offset;
+                });
+
+                for (size_t done = 0; done < command.length;) {
+                    // the copies of a binary diff aren't whole blocks, nothing else can replace them
+                    if (block == blocks.begin() || (block - 1)->offset != command.offset + done ||
+                        (block - 1)->length > command.length - done) {
+                        pieces.push_back({copy.plan, copy.command, copy.position + done, command.length - done, {}});
+                        break;
+                    }
+
+                    const auto &it = *(block - 1);
+                    Copy piece{copy.plan, copy.command, copy.position + done, it.length, {}};
+                    for (const auto &candidate: invertedBlocksHashes.find(it.hash)) {
+                        const auto &other = blockOf(candidate);
+                        const bool failed = it.length == command.length && candidate.first == command.file && other.offset == it.offset;
+                        if (other.length == it.length && !failed && piece.sources.size() < MAX_ATTEMPTS) {
+                            piece.sources.emplace_back(candidate.first, other.offset);
+                        }
+                    }
+
+                    pieces.push_back(std::move(piece));
+                    done += it.length;
+                    ++block;
+                }
+            }
+
+            pending.clear();
+            for (auto &it: pieces) {
+                if (!it.sources.empty()) {
+                    pending.push_back(&it);
+                }
+            }
+            while (!pending.empty()) {
+                verifyAttempts(pending);
+                std::erase_if(pending, [](Copy *it) { return it->verified || ++it->attempt == it->sources.size(); });
+            }
+
+            // rebuild the plans that had a failed copy: the blocks that were found elsewhere are copied from there,
+            // the rest (a hash collision) is written as is
+            std::map<std::pair<size_t, size_t>, std::vector<const Copy *> > replaced;
+            for (const auto &it: pieces) {
+                replaced[{it.plan, it.command}].push_back(&it);
+            }
+
+            for (auto it = replaced.begin(); it != replaced.end();) {
+                const size_t p = it->first.first;
+                UpdatePlan rebuilt;
+                for (size_t c = 0; c < plans[p].commands.size(); c++) {
+                    const auto &command = plans[p].commands[c];
+                    if (it != replaced.end() && it->first == std::make_pair(p, c)) {
+                        for (const auto *piece: it->second) {
+                            if (piece->verified) {
+                                const auto &[file, offset] = piece->sources[piece->attempt];
+                                rebuilt.copy(file, offset, piece->length);
+                            } else {
+                                rebuilt.write(piece->position, piece->length);
+                            }
+                        }
+                        ++it;
+                    } else if (command.type == UpdatePlan::Command::COPY) {
+                        rebuilt.copy(command.file, command.offset, command.length);
+                    } else if (command.type == UpdatePlan::Command::DIFF) {
+                        rebuilt.diff(command.file, command.offset, command.length);
+                    } else {
+                        rebuilt.write(command.offset, command.length);
+                    }
+                }
+                plans[p] = std::move(rebuilt);
+            }
+        }
+
+        for (size_t i = first; i < last; i++) {
+            const auto &plan = plans[i - first];
+            auto &file_writer = zip.begin("data/" + output_files.relativePath(i).generic_string(),
+                                          maxUpdateFileSize(plan, blockSize));
+
+            if (plan.copyFile) {
+                writeToBuffer(COPY_FILE, writer_buffer);
+                writeToBuffer(*plan.copyFile, writer_buffer + sizeof(char));
+                writeToBuffer(DONE, writer_buffer + sizeof(char) + sizeof(size_t));
+                file_writer.write(writer_buffer, sizeof(char) * 2 + sizeof(size_t));
+                zip.end();
+                std::cout << "\r" << " >> " << output_files.path(i) << std::endl;
+                continue;
+            }
+
+            UpdateFileWriter writer(file_writer, blockSize);
+
+            // raw data is most likely an edit of the input data it replaced: the data right after the last copy,
+            // or the same offset of the reference input (same path / most similar). each block of it is written as
+            // a delta against one of them when that's smaller (the inputs can't be read when diffing against a signature)
+            const auto paired = referenceInputs[i];
+            std::optional<std::pair<size_t, size_t> > lastCopy; // (input file, offset) right after the last copy
+            size_t lastCopyEnd = 0;                              // where the last copy ended in the output
+
+            auto writeBlock = [&](size_t position, std::string_view data) {
+                const size_t rawSize = data.size() + (data.size() == blockSize ? 0 : sizeof(size_t));
+                std::optional<std::string> best;
+                size_t bestFile = 0, bestOffset = 0, bestLength = 0;
+                auto tryReference = [&](size_t file, size_t offset) {
+                    const size_t used = best ? best->size() + UpdateFileWriter::DELTA_HEADER_SIZE : rawSize;
+                    if (offset >= input_files.size(file) || used <= UpdateFileWriter::DELTA_HEADER_SIZE) {
+                        return;
+                    }
+
+                    const auto reference = references.read(file, offset, data.size());
+                    if (auto delta = encodeDelta(reference, data, used - UpdateFileWriter::DELTA_HEADER_SIZE - 1)) {
+                        best = std::move(delta);
+                        bestFile = file;
+                        bestOffset = offset;
+                        bestLength = reference.size();
+                    }
+                };
+
+                if (!signature && lastCopy) {
+                    tryReference(lastCopy->first, lastCopy->second + position - lastCopyEnd);
+                }
+                if (paired && !(lastCopy && lastCopy->first == *paired && lastCopy->second == lastCopyEnd)) {
+                    tryReference(*paired, position);
+                }
+
+                if (best) {
+                    writer.writeDelta(bestFile, bestOffset, bestLength, data.size(), *best);
+                } else {
+                    writer.write(data.data(), data.size());
+                }
+            };
+
+            size_t position = 0;
+            for (const auto &it: plan.commands) {
+                if (it.type == UpdatePlan::Command::COPY) {
+                    // a whole block (the last one of a file can be shorter), binary diffs also copy partial blocks
+                    const bool wholeBlock = it.length == blockSize || it.offset + it.length == input_files.size(it.file);
+                    if (!chunker && it.length <= blockSize && it.offset % blockSize == 0 && wholeBlock) {
+                        writer.copyBlock(it.file, it.offset / blockSize, it.length);
+                    } else {
+                        writer.copyRange(it.file, it.offset, it.length);
+                    }
+                    position += it.length;
+                    lastCopy = {it.file, it.offset + it.length};
+                    lastCopyEnd = position;
+                    continue;
+                }
+
+                if (it.type == UpdatePlan::Command::DIFF) {
+                    writer.beginDiff(it.file, it.offset, it.length);
+                    for (size_t done = 0; done < it.length;) {
+                        const auto count = std::min(WRITER_BUFFER_SIZE, it.length - done);
+                        const auto newData = outputs.read(i, position + done, count);
+                        const auto oldData = references.read(it.file, it.offset + done, count);
+                        if (newData.size() != count || oldData.size() != count) {
+                            throw std::runtime_error("File changed while writing: " + output_files.path(i).string());
+                        }
+
+                        for (size_t k = 0; k < count; k++) {
+                            writer_buffer[k] = static_cast<char>(newData[k] - oldData[k]);
+                        }
+                        writer.writeDiff(writer_buffer, count);
+                        done += count;
+                    }
+                    position += it.length;
+                    lastCopy = {it.file, it.offset + it.length};
+                    lastCopyEnd = position;
+                    continue;
+                }
+
+                // read back in whole blocks, so the data isn't split into more commands than needed
+                const size_t readSize = std::max<size_t>(1, WRITER_BUFFER_SIZE / blockSize) * blockSize;
+                for (size_t done = 0; done < it.length; done += readSize) {
+                    const auto data = outputs.read(i, it.offset + done, std::min(readSize, it.length - done));
+                    if (data.empty()) {
+                        throw std::runtime_error("Output file changed while writing: " + output_files.path(i).string());
+                    }
+
+                    for (size_t offset = 0; offset < data.size(); offset += blockSize) {
+                        writeBlock(it.offset + done + offset, data.substr(offset, blockSize));
+                    }
+                }
+                position += it.length;
+            }
+
+            writer.finish();
+            zip.end();
+            std::cout << "\r" << " >> " << output_files.path(i) << std::endl;
+        }
+
+        progress_bar::setProgress(static_cast<long long>(last));
+        first = last;
     }
 
     delete[] writer_buffer;
@@ -323,21 +1430,17 @@ int main(int argc, char *argv[]) {
     // write hashes in a file for validation
     if (vm == "all" || vm == "output") {
         std::cout << "Output validation is enabled. building output validation file ." << std::endl;
-        auto ov = cacheDir / "ov";
-        std::ofstream ov_file(ov);
+        std::ostringstream ov_file;
         for (const auto &it: progress_bar::from(outputFilesHashes, outputFilesHashes.size() - 1, "Output Hashes")) {
-            ov_file << it.second.path << " " << it.second.hash << std::endl;
+            ov_file << it.second.path << " " << toHex(it.second.hash) << std::endl;
         }
-        ov_file.close();
+        zip.add("ov", ov_file.str());
         std::cout << " .. Done" << std::endl;
     }
 
-    std::cout << "Zipping Files .. ";
-    if (zipFolder(cacheDir, output)) {
-        std::cout << "Done" << std::endl;
-    } else {
-        std::cout << "Failed (see errors)" << std::endl;
-    }
+    std::cout << "Finalizing Archive .. ";
+    zip.finalize();
+    std::cout << "Done" << std::endl;
 
     return 0;
 }
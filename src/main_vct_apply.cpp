@@ -0,0 +1,543 @@
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+#include "args_parser.h"
+#include "block_delta.h"
+#include "commands.h"
+#include "file_utils.h"
+#include "patch_reader.h"
+#include "progress_bar.h"
+
+// gives access to the input files, it keeps the most recently used ones open (mapped)
+// so consecutive copies from the same file don't reopen it for every block.
+// an input can also be spilled: the parts of it that are still needed are copied aside,
+// so the file itself can be overwritten while later reads are served from the copy.
+class InputFiles {
+public:
+    InputFiles(const fs::path &root, const std::vector<fs::path> &inputs)
+        : root(root), inputs(inputs), open([this](size_t id) { return path(id); }, FileView::SEQUENTIAL) {}
+
+    InputFiles(const InputFiles &) = delete;
+    InputFiles &operator=(const InputFiles &) = delete;
+
+    ~InputFiles() {
+        for (const auto &it: spills) {
+            std::error_code ec;
+            fs::remove(it.second.path, ec);
+        }
+    }
+
+    [[nodiscard]] fs::path path(size_t id) const {
+        if (id >= inputs.size()) {
+            throw std::runtime_error("Invalid input file id: " + std::to_string(id));
+        }
+        if (const auto it = moved.find(id); it != moved.end()) {
+            return it->second;
+        }
+        return root / inputs[id];
+    }
+
+    // moves an input file out of the way (renamed, so it's cheap), every later access uses the new path
+    void relocate(size_t id, const fs::path &newPath) {
+        const auto oldPath = path(id);
+        close(id);
+        fs::rename(oldPath, newPath);
+        moved[id] = newPath;
+    }
+
+    [[nodiscard]] bool isSpilled(size_t id) const { return spills.contains(id); }
+
+    std::string_view read(size_t id, size_t offset, size_t length) {
+        const auto spill = spills.find(id);
+        if (spill == spills.end()) {
+            return open.read(id, offset, length);
+        }
+
+        // find the spilled range that contains this read
+        const auto &ranges = spill->second.ranges;
+        auto it = std::upper_bound(ranges.begin(), ranges.end(), offset, [](size_t value, const SpilledRange &range) {
+            return value < range.offset;
+        });
+        if (it == ranges.begin() || offset >= (it - 1)->offset + (it - 1)->length) {
+            throw std::runtime_error("Reading a part of an overwritten file that wasn't spilled: " + path(id).string());
+        }
+
+        --it;
+        length = std::min(length, it->offset + it->length - offset);
+        return spill->second.view->read(it->spillOffset + offset - it->offset, length);
+    }
+
+    // drops the mapping of an input file (before it gets overwritten)
+    void close(size_t id) {
+        open.close(id);
+    }
+
+    // copies the given (offset, length) ranges of an input file to spillPath, every later read
+    // of these ranges is served from the spill file instead of the input file.
+    void spill(size_t id, std::vector<std::pair<size_t, size_t> > ranges, const fs::path &spillPath) {
+        auto &view = open.get(id);
+        std::sort(ranges.begin(), ranges.end());
+
+        Spill spill;
+        spill.path = spillPath;
+        std::ofstream writer(spillPath, std::ios::binary | std::ios::trunc);
+        size_t spillOffset = 0;
+        for (const auto &[offset, length]: ranges) {
+            const size_t from = std::min(offset, view.size());
+            const size_t to = std::min(view.size(), length > view.size() - from ? view.size() : from + length);
+
+            // merge overlapping / touching ranges
+            if (!spill.ranges.empty() && from <= spill.ranges.back().offset + spill.ranges.back().length) {
+                auto &last = spill.ranges.back();
+                const auto lastEnd = last.offset + last.length;
+                if (to > lastEnd) {
+                    const auto data = view.read(lastEnd, to - lastEnd);
+                    writer.write(data.data(), static_cast<std::streamsize>(data.size()));
+                    last.length += data.size();
+                    spillOffset += data.size();
+                }
+                continue;
+            }
+
+            if (to <= from) {
+                continue;
+            }
+
+            const auto data = view.read(from, to - from);
+            writer.write(data.data(), static_cast<std::streamsize>(data.size()));
+            spill.ranges.push_back({.offset = from, .length = data.size(), .spillOffset = spillOffset});
+            spillOffset += data.size();
+        }
+        writer.close();
+
+        if (!writer) {
+            throw std::runtime_error("Failed to write spill file: " + spillPath.string());
+        }
+
+        close(id);
+        spill.view = std::make_unique<FileView>(spillPath, FileView::RANDOM);
+        spills[id] = std::move(spill);
+    }
+
+private:
+    struct SpilledRange {
+        size_t offset;      // in the input file
+        size_t length;
+        size_t spillOffset; // in the spill file
+    };
+
+    struct Spill {
+        fs::path path;
+        std::vector<SpilledRange> ranges;
+        std::unique_ptr<FileView> view;
+    };
+
+    fs::path root;
+    const std::vector<fs::path> &inputs;
+    OpenFiles open;
+    std::unordered_map<size_t, Spill> spills;
+    std::unordered_map<size_t, fs::path> moved;
+};
+
+// buffers reused for all the output files
+struct WriteBuffers {
+    static constexpr size_t WRITER_BUFFER_SIZE = 4 * 1024 * 1024;
+    static constexpr size_t PAYLOAD_BUFFER_SIZE = 256 * 1024;
+
+    std::vector<char> writer = std::vector<char>(WRITER_BUFFER_SIZE);
+    std::vector<char> payload = std::vector<char>(PAYLOAD_BUFFER_SIZE);
+    std::string delta;
+};
+
+// executes the commands of one update file, writing the result to target
+static void writeOutputFile(PatchReader &patch, mz_uint index, const fs::path &target, InputFiles &inputs, WriteBuffers &buffers) {
+    CommandStream commands(patch, index);
+    Command command{};
+    if (!commands.next(command)) {
+        std::ofstream(target, std::ios::binary | std::ios::trunc);
+        return;
+    }
+
+    if (command.type == COPY_FILE && !inputs.isSpilled(command.file)) {
+        // the whole file is the same .. let the os copy it
+        fs::copy_file(inputs.path(command.file), target, fs::copy_options::overwrite_existing);
+        return;
+    }
+
+    std::ofstream file_writer;
+    file_writer.rdbuf()->pubsetbuf(buffers.writer.data(), static_cast<std::streamsize>(buffers.writer.size()));
+    file_writer.open(target, std::ios::binary | std::ios::trunc);
+    if (!file_writer) {
+        throw std::runtime_error("Cannot write file: " + target.string());
+    }
+
+    do {
+        switch (command.type) {
+            case COPY_FILE:
+                command.length = std::numeric_limits<size_t>::max();
+                [[fallthrough]];
+            case COPY_BLOCK:
+            case COPY_RANGE: {
+                const auto data = inputs.read(command.file, command.offset, command.length);
+                file_writer.write(data.data(), static_cast<std::streamsize>(data.size()));
+                break;
+            }
+            case WRITE_BLOCK:
+            case WRITE_BYTES:
+                for (size_t r = command.length; r > 0;) {
+                    const auto count = std::min(r, buffers.payload.size());
+                    commands.read(buffers.payload.data(), count);
+                    file_writer.write(buffers.payload.data(), static_cast<std::streamsize>(count));
+                    r -= count;
+                }
+                break;
+            case DIFF_RANGE:
+                for (size_t done = 0; done < command.length;) {
+                    const auto reference = inputs.read(command.file, command.offset + done,
+                                                       std::min(command.length - done, buffers.payload.size()));
+                    if (reference.empty()) {
+                        throw std::runtime_error("Diff reads past the end of: " + inputs.path(command.file).string());
+                    }
+
+                    commands.read(buffers.payload.data(), reference.size());
+                    for (size_t k = 0; k < reference.size(); k++) {
+                        buffers.payload[k] = static_cast<char>(buffers.payload[k] + reference[k]);
+                    }
+                    file_writer.write(buffers.payload.data(), static_cast<std::streamsize>(reference.size()));
+                    done += reference.size();
+                }
+                break;
+            case DELTA_BLOCK: {
+                // never more than a block, so it's read at once
+                buffers.delta.resize(command.delta);
+                commands.read(buffers.delta.data(), command.delta);
+                const auto reference = inputs.read(command.file, command.offset, command.length);
+                applyDelta(reference, buffers.delta, command.size, file_writer);
+                break;
+            }
+            default:
+                throw std::runtime_error("Unexpected command in: " + target.string());
+        }
+    } while (commands.next(command));
+
+    file_writer.close();
+    if (!file_writer) {
+        throw std::runtime_error("Failed to write file: " + target.string());
+    }
+}
+
+// removes the parent folders of path as long as they are empty (stops at root)
+static void removeEmptyParents(const fs::path &root, const fs::path &path) {
+    std::error_code ec;
+    for (auto dir = path.parent_path(); dir != root && fs::is_empty(dir, ec) && !ec; dir = dir.parent_path()) {
+        fs::remove(dir, ec);
+    }
+}
+
+// removes a file, then its parent folders as long as they are empty (stops at root)
+static void removeFile(const fs::path &root, const fs::path &path) {
+    fs::remove(path);
+    removeEmptyParents(root, path);
+}
+
+// applies the update on the input folder itself. an output file that replaces an input file can only
+// be written once every other output file that reads from that input is done, so the outputs are
+// ordered using this dependency graph. when the remaining files depend on each other (a cycle), the
+// input with the fewest pending readers gets the parts that are still needed spilled to a temp file.
+// a file that reads from its own old version is written to a temp file first then renamed over it.
+static void applyInPlace(PatchReader &patch, const fs::path &root, InputFiles &inputs, WriteBuffers &buffers) {
+    constexpr size_t NONE = std::numeric_limits<size_t>::max();
+    const auto &outputs = patch.outputs();
+    const size_t n = outputs.size();
+
+    // collect what each output reads (and skip the payloads)
+    std::vector<std::vector<std::array<size_t, 3> > > reads(n); // (file, offset, length)
+    std::vector<std::vector<size_t> > sources(n);                 // unique input ids each output reads
+    std::vector<bool> unchanged(n, false);                        // COPY_FILE from the same path .. nothing to do
+    std::map<fs::path, size_t> inputByPath;
+    for (size_t i = 0; i < patch.inputs().size(); i++) {
+        inputByPath[patch.inputs()[i]] = i;
+    }
+
+    std::vector<size_t> target(n, NONE);    // the input id each output overwrites
+    std::vector<size_t> writer(patch.inputs().size(), NONE); // the output that overwrites each input
+    for (const auto &i: progress_bar::ranged<long>(0, static_cast<long>(n) - 1, 1, "Planning")) {
+        if (const auto it = inputByPath.find(outputs[i].first); it != inputByPath.end()) {
+            target[i] = it->second;
+            writer[it->second] = i;
+        }
+
+        CommandStream commands(patch, outputs[i].second);
+        Command command{};
+        while (commands.next(command)) {
+            switch (command.type) {
+                case COPY_FILE:
+                    reads[i].push_back({command.file, 0, NONE});
+                    unchanged[i] = command.file == target[i];
+                    break;
+                case COPY_BLOCK:
+                case COPY_RANGE:
+                    reads[i].push_back({command.file, command.offset, command.length});
+                    break;
+                case DELTA_BLOCK:
+                    reads[i].push_back({command.file, command.offset, command.length});
+                    commands.skip(command.delta);
+                    break;
+                case DIFF_RANGE:
+                    reads[i].push_back({command.file, command.offset, command.length});
+                    commands.skip(command.length);
+                    break;
+                default:
+                    commands.skip(command.length);
+            }
+        }
+
+        for (const auto &it: reads[i]) {
+            sources[i].push_back(it[0]);
+        }
+        std::sort(sources[i].begin(), sources[i].end());
+        sources[i].erase(std::unique(sources[i].begin(), sources[i].end()), sources[i].end());
+    }
+    std::cout << std::endl;
+
+    // readers[d] -> outputs that still need input d
+    std::vector<std::vector<size_t> > readers(patch.inputs().size());
+    std::vector<size_t> readersLeft(patch.inputs().size(), 0);
+    std::vector<size_t> blockedBy(n, 0); // number of other pending outputs reading our target
+    for (size_t i = 0; i < n; i++) {
+        for (const auto d: sources[i]) {
+            readers[d].push_back(i);
+            readersLeft[d]++;
+            if (writer[d] != NONE && writer[d] != i) {
+                blockedBy[writer[d]]++;
+            }
+        }
+    }
+
+    // inputs that nobody reads and are not part of the output are removed right away to free space
+    for (size_t d = 0; d < patch.inputs().size(); d++) {
+        if (readersLeft[d] == 0 && writer[d] == NONE) {
+            removeFile(root, inputs.path(d));
+        }
+    }
+
+    // an input file where the output has a folder (x -> x/y), or inside a folder that becomes an output file
+    // (x/y -> x), is in the way of the outputs. the ones still read are moved aside before anything is written,
+    // so the tree is never left half updated because a folder couldn't be created
+    std::set<fs::path> outputFiles, outputFolders;
+    for (const auto &it: outputs) {
+        outputFiles.insert(it.first);
+        for (auto dir = it.first.parent_path(); !dir.empty(); dir = dir.parent_path()) {
+            outputFolders.insert(dir);
+        }
+    }
+
+    for (size_t d = 0; d < patch.inputs().size(); d++) {
+        if (readersLeft[d] == 0 && writer[d] == NONE) {
+            continue; // already removed
+        }
+
+        const auto &path = patch.inputs()[d];
+        bool inTheWay = outputFolders.contains(path);
+        for (auto dir = path.parent_path(); !inTheWay && !dir.empty(); dir = dir.parent_path()) {
+            inTheWay = outputFiles.contains(dir);
+        }
+
+        if (inTheWay) {
+            const auto original = inputs.path(d);
+            inputs.relocate(d, root / (".vct_moved_" + std::to_string(d)));
+            removeEmptyParents(root, original);
+        }
+    }
+
+    std::vector<bool> done(n, false);
+    std::set<size_t> ready;
+    for (size_t i = 0; i < n; i++) {
+        if (blockedBy[i] == 0) {
+            ready.insert(i);
+        }
+    }
+
+    progress_bar::set(progress_bar::defaultBarWithTitle("Writing Output Files"), static_cast<long long>(n));
+    for (size_t completed = 0; completed < n; completed++) {
+        if (ready.empty()) {
+            // every remaining output waits for another one .. break the cycle at the cheapest point
+            size_t best = NONE;
+            for (size_t i = 0; i < n; i++) {
+                if (!done[i] && (best == NONE || blockedBy[i] < blockedBy[best])) {
+                    best = i;
+                }
+            }
+
+            const auto d = target[best];
+            std::vector<std::pair<size_t, size_t> > ranges;
+            for (const auto reader: readers[d]) {
+                if (done[reader]) continue;
+                for (const auto &it: reads[reader]) {
+                    if (it[0] == d) {
+                        ranges.emplace_back(it[1], it[2]);
+                    }
+                }
+            }
+
+            inputs.spill(d, ranges, root / (".vct_spill_" + std::to_string(d)));
+            blockedBy[best] = 0;
+            ready.insert(best);
+        }
+
+        const auto i = *ready.begin();
+        ready.erase(ready.begin());
+
+        const auto &[path, index] = outputs[i];
+        const auto destination = root / path;
+        const auto d = target[i];
+        if (!unchanged[i]) {
+            fs::create_directories(destination.parent_path());
+
+            const bool readsItself = d != NONE && !inputs.isSpilled(d) && std::binary_search(sources[i].begin(), sources[i].end(), d);
+            if (readsItself) {
+                auto temp = destination;
+                temp += ".vct_tmp";
+                writeOutputFile(patch, index, temp, inputs, buffers);
+                inputs.close(d);
+                fs::rename(temp, destination);
+            } else {
+                if (d != NONE) {
+                    inputs.close(d);
+                }
+                writeOutputFile(patch, index, destination, inputs, buffers);
+            }
+        }
+        done[i] = true;
+
+        // anything waiting on the inputs we just read can move on now
+        for (const auto s: sources[i]) {
+            if (writer[s] != NONE && writer[s] != i && !done[writer[s]] && !inputs.isSpilled(s) && --blockedBy[writer[s]] == 0) {
+                ready.insert(writer[s]);
+            }
+
+            if (--readersLeft[s] == 0 && writer[s] == NONE) {
+                inputs.close(s);
+                removeFile(root, inputs.path(s));
+            }
+        }
+
+        progress_bar::setProgress(static_cast<long long>(completed + 1));
+    }
+}
+
+static bool validateHashes(const fs::path &root, HashType type, const std::map<fs::path, std::string> &hashes, const std::string &name) {
+    bool valid = true;
+    for (const auto &[path, hash]: progress_bar::from(hashes, hashes.size(), name)) {
+        if (!fs::is_regular_file(root / path) || toHex(hashFile(type, (root / path).string())) != hash) {
+            std::cerr << "\r" << " >> hash mismatch: " << root / path << std::endl;
+            valid = false;
+        }
+    }
+    return valid;
+}
+
+int main(int argc, char *argv[]) {
+    std::map<std::string, Option> options;
+    options["-from"] = {
+        .type = Option::STRING,
+        .required = true,
+        .enumValues = {},
+        .desc = "a path to the root of the folder that contains the version you're updating from (required)",
+        .defaultValue = "",
+    };
+
+    options["-to"] = {
+        .type = Option::STRING,
+        .required = false,
+        .enumValues = {},
+        .desc = "where to write the updated version (required unless -inplace is used)",
+        .defaultValue = "",
+    };
+
+    options["-inplace"] = {
+        .type = Option::BOOL,
+        .required = false,
+        .enumValues = {},
+        .desc = "update the -from folder itself instead of writing a new copy (not required)",
+        .defaultValue = "false",
+    };
+
+    options["-i"] = {
+        .type = Option::STRING,
+        .required = false,
+        .enumValues = {},
+        .desc = "the v-diff file to apply (not required)",
+        .defaultValue = "./v-diff.zip",
+    };
+
+    options["-vm"] = {
+        .type = Option::ENUM,
+        .required = false,
+        .enumValues = {"input", "output", "all", "none"},
+        .desc = "which validation files should be checked ? (not required)"
+        "\n     \"input\"  -> validate the input before applying."
+        "\n     \"output\" -> validate the output after applying."
+        "\n     \"all\"    -> validate both input & output."
+        "\n     \"none\"   -> don't validate anything.",
+        .defaultValue = "all",
+    };
+
+    auto args = parseArgs(argc, argv, options);
+
+    const bool inPlace = args["-inplace"] == "true";
+    const fs::path src_path = args["-from"];
+    const fs::path dst_path = inPlace ? src_path : fs::path(args["-to"]);
+    const std::string vm = args["-vm"];
+    const std::string input = args["-i"];
+
+    if (dst_path.empty()) {
+        throw std::invalid_argument("Missing required option: -to");
+    }
+
+    printf("Applying v-diff file \"%s\" on \"%s\" -> \"%s\", \nUsing validation: %s\n", input.c_str(),
+           src_path.string().c_str(), dst_path.string().c_str(), vm.c_str());
+
+    PatchReader patch(input);
+
+    if (vm == "all" || vm == "input") {
+        std::cout << "Validating Inputs .. ";
+        if (!validateHashes(src_path, patch.hashType(), patch.readHashes("iv"), "Validating Inputs")) {
+            std::cout << " .. Failed (the input doesn't match the version the diff was created for)" << std::endl;
+            return 1;
+        }
+        std::cout << " .. Done" << std::endl;
+    }
+
+    std::cout << "Writing Output Files .. " << std::endl;
+    WriteBuffers buffers;
+    InputFiles inputs(src_path, patch.inputs());
+    if (inPlace) {
+        applyInPlace(patch, src_path, inputs, buffers);
+    } else {
+        for (const auto &[path, index]: progress_bar::from(patch.outputs(), patch.outputs().size(), "Writing Output Files")) {
+            const auto target = dst_path / path;
+            fs::create_directories(target.parent_path());
+            writeOutputFile(patch, index, target, inputs, buffers);
+        }
+    }
+    std::cout << " .. Done" << std::endl;
+
+    if (vm == "all" || vm == "output") {
+        std::cout << "Validating Outputs .. ";
+        if (!validateHashes(dst_path, patch.hashType(), patch.readHashes("ov"), "Validating Outputs")) {
+            std::cout << " .. Failed (see errors)" << std::endl;
+            return 1;
+        }
+        std::cout << " .. Done" << std::endl;
+    }
+
+    return 0;
+}
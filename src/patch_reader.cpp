@@ -0,0 +1,174 @@
+#include "patch_reader.h"
+
+#include <cstring>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+#include "commands.h"
+
+PatchReader::PatchReader(const fs::path &path) {
+    if (!mz_zip_reader_init_file(&zip, path.string().c_str(), 0)) {
+        throw std::runtime_error("Failed to open v-diff file: " + path.string());
+    }
+
+    std::string content;
+    if (!readEntry("meta", content)) {
+        mz_zip_reader_end(&zip);
+        throw std::runtime_error("Invalid v-diff file (no meta): " + path.string());
+    }
+
+    std::istringstream meta(content);
+    std::string key;
+    std::string hashName = "sha256"; // archives from before the -hash option
+    while (meta >> key) {
+        if (key == "block_size") {
+            meta >> blockSize_;
+        } else if (key == "hash") {
+            meta >> hashName;
+        } else {
+            meta.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        }
+    }
+
+    try {
+        hashType_ = parseHashType(hashName);
+    } catch (const std::invalid_argument&) {
+        mz_zip_reader_end(&zip);
+        throw std::runtime_error("Unsupported hash (" + hashName + ") in v-diff file: " + path.string());
+    }
+
+    if (blockSize_ == 0 || !readEntry("input_list", content)) {
+        mz_zip_reader_end(&zip);
+        throw std::runtime_error("Invalid v-diff file: " + path.string());
+    }
+
+    // each line is: "<absolute path on the machine that created the diff>" "<relative path>"
+    std::istringstream inputList(content);
+    fs::path absolute, relative;
+    while (inputList >> absolute >> relative) {
+        inputs_.push_back(relative);
+    }
+
+    const std::string prefix = "data/";
+    char name[4096];
+    for (mz_uint i = 0; i < mz_zip_reader_get_num_files(&zip); i++) {
+        if (mz_zip_reader_is_file_a_directory(&zip, i)) {
+            continue;
+        }
+
+        mz_zip_reader_get_filename(&zip, i, name, sizeof(name));
+        if (std::strncmp(name, prefix.c_str(), prefix.size()) == 0) {
+            outputs_.emplace_back(fs::path(name + prefix.size()), i);
+        }
+    }
+}
+
+PatchReader::~PatchReader() {
+    mz_zip_reader_end(&zip);
+}
+
+bool PatchReader::readEntry(const std::string &name, std::string &content) {
+    size_t size = 0;
+    void* data = mz_zip_reader_extract_file_to_heap(&zip, name.c_str(), &size, 0);
+    if (!data) {
+        return false;
+    }
+
+    content.assign(static_cast<const char*>(data), size);
+    mz_free(data);
+    return true;
+}
+
+std::map<fs::path, std::string> PatchReader::readHashes(const std::string &name) {
+    std::map<fs::path, std::string> hashes;
+    std::string content;
+    if (!readEntry(name, content)) {
+        return hashes;
+    }
+
+    std::istringstream lines(content);
+    fs::path path;
+    std::string hash;
+    while (lines >> path >> hash) {
+        hashes[path] = hash;
+    }
+
+    return hashes;
+}
+
+CommandStream::CommandStream(PatchReader &patch, mz_uint index) : blockSize(patch.blockSize()), buffer(64 * 1024) {
+    state = mz_zip_reader_extract_iter_new(&patch.archive(), index, 0);
+    if (!state) {
+        throw std::runtime_error("Failed to read update file #" + std::to_string(index));
+    }
+}
+
+CommandStream::~CommandStream() {
+    mz_zip_reader_extract_iter_free(state);
+}
+
+void CommandStream::read(char *out, size_t length) {
+    while (length > 0) {
+        if (pos == end) {
+            pos = 0;
+            end = mz_zip_reader_extract_iter_read(state, buffer.data(), buffer.size());
+            if (end == 0) {
+                throw std::runtime_error("Unexpected end of update file");
+            }
+        }
+
+        const auto count = std::min(length, end - pos);
+        std::memcpy(out, buffer.data() + pos, count);
+        pos += count;
+        out += count;
+        length -= count;
+    }
+}
+
+void CommandStream::skip(size_t length) {
+    char discard[4096];
+    while (length > 0) {
+        const auto count = std::min(length, sizeof(discard));
+        read(discard, count);
+        length -= count;
+    }
+}
+
+bool CommandStream::next(Command &command) {
+    command = {.type = readValue<char>()};
+    switch (command.type) {
+        case COPY_FILE:
+            command.file = readValue<size_t>();
+            return true;
+        case COPY_BLOCK:
+            command.file = readValue<size_t>();
+            command.offset = readValue<size_t>() * blockSize;
+            command.length = blockSize;
+            return true;
+        case COPY_RANGE:
+        case DIFF_RANGE:
+            command.file = readValue<size_t>();
+            command.offset = readValue<size_t>();
+            command.length = readValue<size_t>();
+            return true;
+        case WRITE_BLOCK:
+            command.length = blockSize;
+            return true;
+        case WRITE_BYTES:
+            command.length = readValue<size_t>();
+            return true;
+        case DELTA_BLOCK:
+            command.file = readValue<size_t>();
+            command.offset = readValue<size_t>();
+            command.length = readValue<size_t>();
+            command.size = readValue<size_t>();
+            command.delta = readValue<size_t>();
+            return true;
+        case DONE:
+            return false;
+        default:
+            throw std::runtime_error("Unknown command: " + std::to_string(static_cast<int>(command.type)));
+    }
+}
@@ -0,0 +1,93 @@
+#ifndef PATCH_READER_H
+#define PATCH_READER_H
+
+#include <filesystem>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "miniz.h"
+#include "file_utils.h"
+
+namespace fs = std::filesystem;
+
+// a single decoded command of an update file, see commands.h
+struct Command {
+    char type;
+    size_t file = 0;   // input file id (COPY_FILE, COPY_BLOCK, COPY_RANGE, DELTA_BLOCK, DIFF_RANGE)
+    size_t offset = 0; // offset in the input file in bytes (COPY_BLOCK, COPY_RANGE, DELTA_BLOCK, DIFF_RANGE)
+    size_t length = 0; // bytes to copy / read from the input, or bytes of payload that follow (WRITE_BLOCK, WRITE_BYTES)
+                       // DIFF_RANGE: both, the bytes read from the input are followed by as many differences
+    size_t size = 0;   // DELTA_BLOCK: bytes written to the output
+    size_t delta = 0;  // DELTA_BLOCK: bytes of delta that follow
+};
+
+// reads a v-diff archive created by vct
+class PatchReader {
+public:
+    explicit PatchReader(const fs::path& path);
+    ~PatchReader();
+
+    PatchReader(const PatchReader&) = delete;
+    PatchReader& operator=(const PatchReader&) = delete;
+
+    [[nodiscard]] size_t blockSize() const { return blockSize_; }
+
+    // the hash used for the iv / ov validation files
+    [[nodiscard]] HashType hashType() const { return hashType_; }
+
+    // relative paths of the input files, indexed by the file id used in the commands
+    [[nodiscard]] const std::vector<fs::path>& inputs() const { return inputs_; }
+
+    // relative paths of the output files and the index of their update file entry
+    [[nodiscard]] const std::vector<std::pair<fs::path, mz_uint>>& outputs() const { return outputs_; }
+
+    // reads a validation file (iv / ov) as relative path -> hex hash, empty if the archive doesn't have it
+    std::map<fs::path, std::string> readHashes(const std::string& name);
+
+    mz_zip_archive& archive() { return zip; }
+
+private:
+    bool readEntry(const std::string& name, std::string& content);
+
+    mz_zip_archive zip{};
+    size_t blockSize_ = 0;
+    HashType hashType_ = HashType::SHA256;
+    std::vector<fs::path> inputs_;
+    std::vector<std::pair<fs::path, mz_uint>> outputs_;
+};
+
+// streams the commands of a single update file, the entry is decompressed
+// on the fly and never fully loaded to memory
+class CommandStream {
+public:
+    CommandStream(PatchReader& patch, mz_uint index);
+    ~CommandStream();
+
+    CommandStream(const CommandStream&) = delete;
+    CommandStream& operator=(const CommandStream&) = delete;
+
+    // reads the next command, returns false once DONE is reached
+    bool next(Command& command);
+
+    // reads the payload that follows a WRITE_BLOCK / WRITE_BYTES / DELTA_BLOCK / DIFF_RANGE command (can be called in chunks)
+    void read(char* out, size_t length);
+    void skip(size_t length);
+
+private:
+    template<typename T>
+    T readValue() {
+        T value;
+        read(reinterpret_cast<char*>(&value), sizeof(T));
+        return value;
+    }
+
+    mz_zip_reader_extract_iter_state* state;
+    size_t blockSize;
+    std::vector<char> buffer;
+    size_t pos = 0;
+    size_t end = 0;
+};
+
+#endif //PATCH_READER_H
@@ -8,6 +8,7 @@
 #include <chrono>
 #include <limits.h>
 #include <sstream>
+#include <iomanip>
 
 #ifdef _WIN32
 #include <windows.h>
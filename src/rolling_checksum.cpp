@@ -0,0 +1,31 @@
+#include "rolling_checksum.h"
+
+void RollingChecksum::reset(const char *data, size_t length) {
+    this->a = 0;
+    this->b = 0;
+    this->length = length;
+
+    for (size_t i = 0; i < length; i++) {
+        const auto x = static_cast<uint8_t>(data[i]);
+        a += x;
+        b += static_cast<uint32_t>(length - i) * x;
+    }
+
+    a &= 0xffff;
+    b &= 0xffff;
+}
+
+void RollingChecksum::roll(char out, char in) {
+    const auto x = static_cast<uint8_t>(out);
+    const auto y = static_cast<uint8_t>(in);
+
+    // remove the byte leaving the window, then add the one entering it
+    a = (a - x + y) & 0xffff;
+    b = (b - static_cast<uint32_t>(length) * x + a) & 0xffff;
+}
+
+uint32_t RollingChecksum::of(const char *data, size_t length) {
+    RollingChecksum checksum;
+    checksum.reset(data, length);
+    return checksum.digest();
+}
@@ -0,0 +1,26 @@
+#ifndef ROLLING_CHECKSUM_H
+#define ROLLING_CHECKSUM_H
+
+#include <cstdint>
+#include <cstddef>
+
+// rsync style weak checksum (adler-32 like, mod 2^16) over a fixed size window.
+// it can be slid one byte at a time in O(1), so it's used to find candidate blocks
+// at any byte offset, the candidates are then confirmed using sha256.
+class RollingChecksum {
+public:
+    RollingChecksum() = default;
+
+    void reset(const char* data, size_t length);
+    void roll(char out, char in);
+    [[nodiscard]] uint32_t digest() const { return (a & 0xffff) | (b << 16); }
+
+    static uint32_t of(const char* data, size_t length);
+
+private:
+    uint32_t a = 0;
+    uint32_t b = 0;
+    size_t length = 0;
+};
+
+#endif //ROLLING_CHECKSUM_H
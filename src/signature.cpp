@@ -0,0 +1,146 @@
+#include "signature.h"
+
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+static constexpr char MAGIC[] = {'V', 'C', 'T', 'S', '2'};
+
+template<typename T>
+static void s_write(std::ostream &out, const T &value) {
+    out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+static void s_writePath(std::ostream &out, const fs::path &path) {
+    const auto str = path.string();
+    s_write(out, str.size());
+    out.write(str.data(), static_cast<std::streamsize>(str.size()));
+}
+
+template<typename T>
+static T s_read(std::istream &in) {
+    T value;
+    if (!in.read(reinterpret_cast<char *>(&value), sizeof(T))) {
+        throw std::runtime_error("Invalid signature file (truncated)");
+    }
+    return value;
+}
+
+static fs::path s_readPath(std::istream &in) {
+    const auto length = s_read<size_t>(in);
+    std::string str(length, '\0');
+    if (!in.read(str.data(), static_cast<std::streamsize>(length))) {
+        throw std::runtime_error("Invalid signature file (truncated)");
+    }
+    return str;
+}
+
+void writeSignature(const fs::path &path, const Signature &signature) {
+    const bool chunked = signature.cdcMax > 0;
+    if (chunked && signature.cdcMax > std::numeric_limits<uint32_t>::max()) {
+        throw std::runtime_error("Chunks are too large for a signature file");
+    }
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("Cannot open file: " + path.string());
+    }
+
+    out.write(MAGIC, sizeof(MAGIC));
+    s_writePath(out, hashTypeName(signature.hash));
+    s_writePath(out, signature.root);
+    s_write(out, signature.blockSize);
+    s_write(out, signature.cdcMin);
+    s_write(out, signature.cdcAvg);
+    s_write(out, signature.cdcMax);
+    s_write(out, signature.files.size());
+
+    for (const auto &file: signature.files) {
+        s_writePath(out, file.relativePath);
+        s_write(out, file.size);
+        s_write(out, file.hash);
+        s_write(out, file.blocks.size());
+
+        for (const auto &block: file.blocks) {
+            if (chunked) {
+                s_write(out, static_cast<uint32_t>(block.length));
+                s_write(out, block.hash);
+            } else {
+                s_write(out, block.hash);
+                s_write(out, block.weak);
+            }
+        }
+    }
+
+    if (!out) {
+        throw std::runtime_error("Failed to write file: " + path.string());
+    }
+}
+
+Signature readSignature(const fs::path &path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Cannot open file: " + path.string());
+    }
+
+    char magic[sizeof(MAGIC)];
+    if (!in.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), MAGIC)) {
+        throw std::runtime_error("Invalid signature file: " + path.string());
+    }
+
+    Signature signature;
+    signature.hash = parseHashType(s_readPath(in).string());
+    signature.root = s_readPath(in);
+    signature.blockSize = s_read<size_t>(in);
+    signature.cdcMin = s_read<size_t>(in);
+    signature.cdcAvg = s_read<size_t>(in);
+    signature.cdcMax = s_read<size_t>(in);
+    if (signature.blockSize == 0) {
+        throw std::runtime_error("Invalid signature file: " + path.string());
+    }
+
+    const bool chunked = signature.cdcMax > 0;
+    const auto count = s_read<size_t>(in);
+    for (size_t i = 0; i < count; i++) {
+        SignatureFile file;
+        file.relativePath = s_readPath(in);
+        file.size = s_read<size_t>(in);
+        file.hash = s_read<Digest>(in);
+
+        // fixed blocks cover the file exactly, extra (empty) blocks would still add up to its size
+        const auto blocksCount = s_read<size_t>(in);
+        if (!chunked && blocksCount != (file.size + signature.blockSize - 1) / signature.blockSize) {
+            throw std::runtime_error("Invalid signature file: " + path.string());
+        }
+
+        size_t offset = 0;
+        for (size_t index = 0; index < blocksCount; index++) {
+            BlockHash block{};
+            block.index = index;
+            block.offset = offset;
+            if (chunked) {
+                block.length = s_read<uint32_t>(in);
+                block.hash = s_read<Digest>(in);
+                if (block.length == 0) {
+                    throw std::runtime_error("Invalid signature file: " + path.string());
+                }
+            } else {
+                block.length = std::min(signature.blockSize, file.size - std::min(offset, file.size));
+                block.hash = s_read<Digest>(in);
+                block.weak = s_read<uint32_t>(in);
+            }
+
+            offset += block.length;
+            file.blocks.push_back(block);
+        }
+
+        if (offset != file.size) {
+            throw std::runtime_error("Invalid signature file: " + path.string());
+        }
+
+        signature.files.push_back(std::move(file));
+    }
+
+    return signature;
+}
@@ -0,0 +1,40 @@
+#ifndef SIGNATURE_H
+#define SIGNATURE_H
+
+#include <filesystem>
+#include <vector>
+
+#include "structures.h"
+#include "file_utils.h"
+
+namespace fs = std::filesystem;
+
+struct SignatureFile {
+    fs::path relativePath;
+    size_t size;
+    Digest hash;
+    std::vector<BlockHash> blocks;
+};
+
+// everything vct needs to know about an input tree to diff against it (created by "vct sign"),
+// so the tree itself doesn't have to be on the machine that creates the v-diff file.
+struct Signature {
+    fs::path root;          // where the tree was when it was signed
+    HashType hash = HashType::SHA256;
+    size_t blockSize = 0;
+    // content defined chunking parameters, all 0 if the files were split into fixed blocks
+    size_t cdcMin = 0;
+    size_t cdcAvg = 0;
+    size_t cdcMax = 0;
+    std::vector<SignatureFile> files;
+};
+
+// binary layout (native endianness):
+//   "VCTS2", hash name, root (length + chars each), block size, cdc min, cdc avg, cdc max, files count, then for every file:
+//   relative path (length + chars), size, digest, blocks count, then for every block:
+//   fixed blocks -> digest + weak checksum, chunks -> length (u32) + digest
+// the block offsets (and fixed block lengths) are implied by the order of the blocks
+void writeSignature(const fs::path& path, const Signature& signature);
+Signature readSignature(const fs::path& path);
+
+#endif //SIGNATURE_H
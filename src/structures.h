@@ -6,18 +6,35 @@
 #define STRUCTURS_H
 
 #include <filesystem>
+#include <cstdint>
+#include <cstring>
+#include <array>
 
 namespace fs = std::filesystem;
 
+// a raw sha256 digest, it's only converted to hex when written to the iv / ov files
+using Digest = std::array<uint8_t, 32>;
+
+struct DigestHash {
+  // the digest is already uniformly distributed, so any 8 bytes of it are a good hash
+  size_t operator()(const Digest& digest) const {
+    size_t h;
+    std::memcpy(&h, digest.data(), sizeof(size_t));
+    return h;
+  }
+};
+
 struct FileHash {
   fs::path path;
-  std::string hash;
+  Digest hash;
 };
 
 struct BlockHash {
-  fs::path path;
   size_t index;
-  std::string hash;
+  size_t offset;   // where the block starts in its file
+  size_t length;   // fixed blocks are all blockSize long (except the last one), chunks vary in size
+  Digest hash;
+  uint32_t weak;   // rolling checksum, only used to find candidates
 };
 
 
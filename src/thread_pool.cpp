@@ -0,0 +1,144 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t threads) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    for (size_t i = 0; i < threads; i++) {
+        queues.push_back(std::make_unique<Worker>());
+    }
+
+    for (size_t i = 0; i < threads; i++) {
+        workers.emplace_back([this, i] { run(i); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    workAvailable.notify_all();
+
+    for (auto& it : workers) {
+        it.join();
+    }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    size_t id;
+    {
+        std::lock_guard lock(mutex);
+        id = next++ % queues.size();
+        pending++;
+    }
+
+    {
+        std::lock_guard lock(queues[id]->mutex);
+        queues[id]->tasks.push_back(std::move(task));
+    }
+
+    {
+        // the counter must be updated while holding the lock, otherwise a worker
+        // might miss the notification between checking it and going to sleep
+        std::lock_guard lock(mutex);
+        ++queued;
+    }
+    workAvailable.notify_one();
+}
+
+void ThreadPool::wait(const std::function<void(size_t)>& onProgress) {
+    std::unique_lock lock(mutex);
+    size_t reported = completed;
+    while (pending > 0) {
+        taskDone.wait(lock);
+        if (onProgress && reported != completed) {
+            reported = completed;
+            lock.unlock();
+            onProgress(reported);
+            lock.lock();
+        }
+    }
+
+    completed = 0;
+    if (error) {
+        auto e = error;
+        error = nullptr;
+        std::rethrow_exception(e);
+    }
+}
+
+bool ThreadPool::pop(size_t id, std::function<void()>& task) {
+    // own queue first (newest task), then steal the oldest task of another worker
+    {
+        auto& own = *queues[id];
+        std::lock_guard lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            --queued;
+            return true;
+        }
+    }
+
+    for (size_t i = 1; i < queues.size(); i++) {
+        auto& other = *queues[(id + i) % queues.size()];
+        std::lock_guard lock(other.mutex);
+        if (!other.tasks.empty()) {
+            task = std::move(other.tasks.front());
+            other.tasks.pop_front();
+            --queued;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::run(size_t id) {
+    while (true) {
+        std::function<void()> task;
+        if (!pop(id, task)) {
+            std::unique_lock lock(mutex);
+            workAvailable.wait(lock, [this] { return stopping || queued > 0; });
+            if (stopping && queued == 0) {
+                return;
+            }
+            continue;
+        }
+
+        std::exception_ptr e = nullptr;
+        try {
+            task();
+        } catch (...) {
+            e = std::current_exception();
+        }
+
+        {
+            std::lock_guard lock(mutex);
+            if (e && !error) {
+                error = e;
+            }
+            pending--;
+            completed++;
+        }
+        taskDone.notify_all();
+    }
+}
+
+MemoryBudget::Reservation::Reservation(MemoryBudget& budget, size_t amount) : budget(budget), amount(amount) {
+    std::unique_lock lock(budget.mutex);
+    budget.released.wait(lock, [&] { return budget.used == 0 || budget.used + amount <= budget.limit; });
+    budget.used += amount;
+}
+
+MemoryBudget::Reservation::~Reservation() {
+    {
+        std::lock_guard lock(budget.mutex);
+        budget.used -= amount;
+    }
+    budget.released.notify_all();
+}
@@ -0,0 +1,83 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// a simple work stealing thread pool, each worker has its own queue and
+// when it runs out of work it steals from the other workers queues.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threads = 0); // 0 -> use all cores
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(std::function<void()> task);
+
+    // blocks until all the submitted tasks are done, onProgress is called (on the calling thread)
+    // with the number of completed tasks every time it changes.
+    // rethrows the first exception thrown by any task.
+    void wait(const std::function<void(size_t)>& onProgress = nullptr);
+
+    [[nodiscard]] size_t size() const { return workers.size(); }
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void run(size_t id);
+    bool pop(size_t id, std::function<void()>& task);
+
+    std::vector<std::unique_ptr<Worker>> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable workAvailable;
+    std::condition_variable taskDone;
+    std::atomic<size_t> queued = 0;
+    size_t pending = 0;
+    size_t completed = 0;
+    size_t next = 0;
+    bool stopping = false;
+    std::exception_ptr error;
+};
+
+// a number of bytes shared by the tasks of a pool, so memory hungry tasks don't all run at once.
+// a task reserves what it needs for as long as the Reservation lives, it waits until it fits
+// (a task that needs more than the whole limit runs once nothing else is reserved).
+class MemoryBudget {
+public:
+    explicit MemoryBudget(size_t limit) : limit(limit) {}
+
+    class Reservation {
+    public:
+        Reservation(MemoryBudget& budget, size_t amount);
+        ~Reservation();
+
+        Reservation(const Reservation&) = delete;
+        Reservation& operator=(const Reservation&) = delete;
+
+    private:
+        MemoryBudget& budget;
+        size_t amount;
+    };
+
+private:
+    size_t limit;
+    size_t used = 0;
+    std::mutex mutex;
+    std::condition_variable released;
+};
+
+#endif //THREAD_POOL_H
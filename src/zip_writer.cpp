@@ -0,0 +1,352 @@
+#include "zip_writer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+static constexpr size_t CHUNK_SIZE = 1024 * 1024;
+static constexpr size_t MAX_QUEUED_CHUNKS = 4;
+static constexpr size_t BLOCK_SIZE = 4 * 1024 * 1024;
+
+ZipWriter::ZipWriter(const fs::path &path, int level, ThreadPool *pool)
+    : level(level), pool(pool), entryBuffer(*this), entryStream(&entryBuffer) {
+    if (!mz_zip_writer_init_file(&zip, path.string().c_str(), 0)) {
+        throw std::runtime_error("Failed to create ZIP file: " + path.string());
+    }
+}
+
+ZipWriter::~ZipWriter() {
+    if (compressor.joinable()) {
+        {
+            std::lock_guard lock(mutex);
+            closing = true;
+        }
+        changed.notify_all();
+        compressor.join();
+    }
+
+    if (!finalized) {
+        mz_zip_writer_end(&zip);
+    }
+}
+
+void ZipWriter::add(const std::string &name, const std::string &content) {
+    appendCompressed(true);
+    if (!mz_zip_writer_add_mem(&zip, name.c_str(), content.data(), content.size(), level)) {
+        throw std::runtime_error("Failed to add file to ZIP: " + name);
+    }
+}
+
+std::ostream &ZipWriter::begin(const std::string &name, size_t maxSize) {
+    if (compressor.joinable() || buffered || parallel) {
+        throw std::logic_error("ZipWriter: an entry is already open");
+    }
+
+    entryName = name;
+    chunks.clear();
+    chunkOffset = 0;
+    closing = false;
+    failed = false;
+    entryBuffer.reset();
+    entryStream.clear();
+
+    current = PendingEntry();
+    current.name = name;
+    bufferedData.clear();
+
+    // nothing to do in parallel when the data is only stored
+    if (pool && level > 0 && maxSize <= BLOCK_SIZE) {
+        buffered = true;
+        bufferedData.reserve(maxSize);
+        return entryStream;
+    }
+
+    // streamed entries are written right away, so everything before them must be appended first
+    appendCompressed(true);
+
+    if (pool && level > 0) {
+        parallel = true;
+        maxEntrySize = maxSize;
+        bufferedData.reserve(BLOCK_SIZE);
+        return entryStream;
+    }
+
+    startWriting(maxSize, level, false);
+    return entryStream;
+}
+
+void ZipWriter::startWriting(size_t maxSize, int entryLevel, bool precompressed) {
+    compressor = std::thread([this, maxSize, entryLevel, precompressed] {
+        const auto flags = static_cast<mz_uint>(entryLevel) | (precompressed ? MZ_ZIP_FLAG_COMPRESSED_DATA : 0);
+        const bool ok = mz_zip_writer_add_read_buf_callback_v2(&zip, entryName.c_str(), s_read, this, maxSize, nullptr,
+                                                               nullptr, 0, flags, nullptr, 0, nullptr, 0,
+                                                               &current.size, &current.crc);
+        if (!ok) {
+            std::lock_guard lock(mutex);
+            failed = true;
+            chunks.clear();
+        }
+        changed.notify_all();
+    });
+}
+
+void ZipWriter::end() {
+    entryStream.flush();
+
+    if (buffered) {
+        buffered = false;
+        if (!entryStream) {
+            throw std::runtime_error("Failed to add file to ZIP: " + entryName);
+        }
+
+        auto task = std::make_shared<std::packaged_task<std::shared_ptr<CompressedBlock>()>>(
+            [data = std::move(bufferedData), level = level]() mutable {
+                return s_compress(std::move(data), level, true, true);
+            });
+        current.block = task->get_future();
+        pool->submit([task] { (*task)(); });
+        bufferedData = std::vector<char>();
+        compressing.push_back(std::move(current));
+
+        // don't let too many entries pile up in memory
+        appendCompressed(compressing.size() > pool->size() * 2);
+        return;
+    }
+
+    if (parallel && entryStream) {
+        submitBlock(true);
+        writeBlocks(true);
+    }
+    parallel = false;
+    blocks.clear();
+
+    if (compressor.joinable()) {
+        {
+            std::lock_guard lock(mutex);
+            closing = true;
+        }
+        changed.notify_all();
+        compressor.join();
+    }
+
+    if (failed || !entryStream) {
+        throw std::runtime_error("Failed to add file to ZIP: " + entryName);
+    }
+}
+
+void ZipWriter::finalize() {
+    appendCompressed(true);
+    const bool ok = mz_zip_writer_finalize_archive(&zip);
+    mz_zip_writer_end(&zip);
+    finalized = true;
+
+    if (!ok) {
+        throw std::runtime_error("Failed to finalize ZIP file");
+    }
+}
+
+// deflate falls back to stored blocks for data it can't shrink, so it never grows by more than a few bytes per 64 KB
+static size_t s_deflateBound(size_t size) {
+    return size + size / 1024 + 1024;
+}
+
+void ZipWriter::submitBlock(bool last) {
+    auto data = std::move(bufferedData);
+    bufferedData = std::vector<char>();
+    if (!last) {
+        bufferedData.reserve(BLOCK_SIZE);
+    }
+
+    // the first block decides how the whole entry is written, it can't change once the writing started
+    if (!compressor.joinable()) {
+        const auto block = s_compress(std::move(data), level, true, last);
+        if (block->compressed.empty()) {
+            // not worth it .. the rest likely won't shrink either, store the entry as is
+            parallel = false;
+            startWriting(maxEntrySize, MZ_NO_COMPRESSION, false);
+            queue(std::move(block->data));
+        } else {
+            startWriting(s_deflateBound(maxEntrySize), level, true);
+            queue(std::move(block->compressed));
+        }
+        return;
+    }
+
+    auto task = std::make_shared<std::packaged_task<std::shared_ptr<CompressedBlock>()>>(
+        [data = std::move(data), level = level, last]() mutable {
+            return s_compress(std::move(data), level, false, last);
+        });
+    blocks.push_back(task->get_future());
+    pool->submit([task] { (*task)(); });
+
+    writeBlocks(false);
+}
+
+void ZipWriter::writeBlocks(bool wait) {
+    // a big entry can't have more blocks in memory than the pool keeps busy
+    const auto limit = pool->size() * 2;
+    while (!blocks.empty()) {
+        auto &front = blocks.front();
+        if (!wait && blocks.size() <= limit && front.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            return;
+        }
+
+        const auto block = front.get();
+        blocks.pop_front();
+        queue(std::move(block->compressed));
+    }
+}
+
+std::shared_ptr<ZipWriter::CompressedBlock> ZipWriter::s_compress(std::vector<char> &&data, int level, bool first, bool last) {
+    auto block = std::make_shared<CompressedBlock>();
+
+    const std::unique_ptr<tdefl_compressor, decltype(&tdefl_compressor_free)> compressor(tdefl_compressor_alloc(), tdefl_compressor_free);
+    if (!compressor) {
+        throw std::runtime_error("Failed to allocate the ZIP compressor");
+    }
+
+    const auto flags = static_cast<int>(tdefl_create_comp_flags_from_zip_params(level, -15, MZ_DEFAULT_STRATEGY));
+    const auto append = [](const void *buffer, int length, void *user) -> mz_bool {
+        auto &out = *static_cast<std::vector<char> *>(user);
+        out.insert(out.end(), static_cast<const char *>(buffer), static_cast<const char *>(buffer) + length);
+        return MZ_TRUE;
+    };
+    block->compressed.reserve(data.size() / 2);
+    tdefl_init(compressor.get(), append, &block->compressed, flags);
+
+    const auto status = tdefl_compress_buffer(compressor.get(), data.data(), data.size(), last ? TDEFL_FINISH : TDEFL_SYNC_FLUSH);
+    if (status != (last ? TDEFL_STATUS_DONE : TDEFL_STATUS_OKAY)) {
+        throw std::runtime_error("Failed to compress ZIP entry");
+    }
+
+    // not worth it .. the entry is better stored as is
+    if (first && block->compressed.size() >= data.size()) {
+        block->data = std::move(data);
+        block->compressed = std::vector<char>();
+    }
+
+    return block;
+}
+
+void ZipWriter::appendCompressed(bool wait) {
+    while (!compressing.empty()) {
+        auto &entry = compressing.front();
+        if (!wait && entry.block.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            return;
+        }
+
+        const auto block = entry.block.get();
+        bool ok;
+        if (block->compressed.empty()) {
+            ok = mz_zip_writer_add_mem(&zip, entry.name.c_str(), block->data.data(), block->data.size(), MZ_NO_COMPRESSION);
+        } else {
+            ok = mz_zip_writer_add_mem_ex_v2(&zip, entry.name.c_str(), block->compressed.data(), block->compressed.size(), nullptr, 0,
+                                             level | MZ_ZIP_FLAG_COMPRESSED_DATA, entry.size, entry.crc,
+                                             nullptr, nullptr, 0, nullptr, 0);
+        }
+
+        if (!ok) {
+            throw std::runtime_error("Failed to add file to ZIP: " + entry.name);
+        }
+        compressing.pop_front();
+    }
+}
+
+void ZipWriter::push(std::vector<char> &&chunk) {
+    if (buffered || parallel) {
+        current.crc = static_cast<mz_uint32>(mz_crc32(current.crc, reinterpret_cast<const mz_uint8 *>(chunk.data()), chunk.size()));
+        current.size += chunk.size();
+        bufferedData.insert(bufferedData.end(), chunk.begin(), chunk.end());
+        if (parallel && bufferedData.size() >= BLOCK_SIZE) {
+            submitBlock(false);
+        }
+        return;
+    }
+
+    queue(std::move(chunk));
+}
+
+void ZipWriter::queue(std::vector<char> &&chunk) {
+    // an empty chunk would read as the end of the entry
+    if (chunk.empty()) {
+        return;
+    }
+
+    std::unique_lock lock(mutex);
+    changed.wait(lock, [this] { return failed || chunks.size() < MAX_QUEUED_CHUNKS; });
+    if (failed) {
+        throw std::runtime_error("Failed to add file to ZIP: " + entryName);
+    }
+
+    chunks.push_back(std::move(chunk));
+    lock.unlock();
+    changed.notify_all();
+}
+
+size_t ZipWriter::pull(char *buffer, size_t n) {
+    std::unique_lock lock(mutex);
+    changed.wait(lock, [this] { return closing || !chunks.empty(); });
+
+    size_t count = 0;
+    while (count < n && !chunks.empty()) {
+        auto &front = chunks.front();
+        const auto available = std::min(n - count, front.size() - chunkOffset);
+        std::memcpy(buffer + count, front.data() + chunkOffset, available);
+        count += available;
+        chunkOffset += available;
+
+        if (chunkOffset == front.size()) {
+            chunks.pop_front();
+            chunkOffset = 0;
+        }
+    }
+
+    lock.unlock();
+    changed.notify_all();
+    return count; // 0 only once the entry is closed and fully consumed
+}
+
+size_t ZipWriter::s_read(void *opaque, mz_uint64, void *buffer, size_t n) {
+    return static_cast<ZipWriter *>(opaque)->pull(static_cast<char *>(buffer), n);
+}
+
+ZipWriter::EntryBuffer::EntryBuffer(ZipWriter &zip) : zip(zip) {
+    reset();
+}
+
+void ZipWriter::EntryBuffer::reset() {
+    chunk.resize(CHUNK_SIZE);
+    setp(chunk.data(), chunk.data() + chunk.size());
+}
+
+ZipWriter::EntryBuffer::int_type ZipWriter::EntryBuffer::overflow(int_type ch) {
+    if (sync() != 0) {
+        return traits_type::eof();
+    }
+
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+    }
+    return traits_type::not_eof(ch);
+}
+
+int ZipWriter::EntryBuffer::sync() {
+    const auto used = static_cast<size_t>(pptr() - pbase());
+    if (used == 0) {
+        return 0;
+    }
+
+    chunk.resize(used);
+    try {
+        zip.push(std::move(chunk));
+    } catch (const std::exception &) {
+        reset();
+        return -1;
+    }
+
+    chunk = std::vector<char>();
+    reset();
+    return 0;
+}
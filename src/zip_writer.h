@@ -0,0 +1,125 @@
+#ifndef ZIP_WRITER_H
+#define ZIP_WRITER_H
+
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <future>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "miniz.h"
+#include "thread_pool.h"
+
+namespace fs = std::filesystem;
+
+// writes a zip archive directly, entries can be streamed: whatever is written to the stream returned
+// by begin() is handed in chunks to a compression thread, so an entry is never fully in memory (or on disk).
+// when a pool is given, the work moves to its workers (pigz style): small entries are compressed whole
+// and kept in memory until it's their turn (many entries at once), bigger ones are cut into blocks that
+// are compressed in parallel and written to the archive in order as they finish, only a bounded window
+// of blocks is in memory. entries are still appended in the order they were written.
+class ZipWriter {
+public:
+    ZipWriter(const fs::path& path, int level, ThreadPool* pool = nullptr);
+    ~ZipWriter();
+
+    ZipWriter(const ZipWriter&) = delete;
+    ZipWriter& operator=(const ZipWriter&) = delete;
+
+    // adds a small entry from memory
+    void add(const std::string& name, const std::string& content);
+
+    // starts streaming an entry, maxSize must be an upper bound of its size (it decides if zip64 is needed)
+    std::ostream& begin(const std::string& name, size_t maxSize);
+
+    // finishes the entry started by begin()
+    void end();
+
+    // writes the central directory and closes the archive
+    void finalize();
+
+private:
+    // collects the written bytes into chunks and passes them to the compression thread
+    class EntryBuffer : public std::streambuf {
+    public:
+        explicit EntryBuffer(ZipWriter& zip);
+        void reset();
+
+    protected:
+        int_type overflow(int_type ch) override;
+        int sync() override;
+
+    private:
+        ZipWriter& zip;
+        std::vector<char> chunk;
+    };
+
+    // a block of an entry compressed by a worker. every block is its own raw deflate stream, all but the
+    // last one end with a sync flush (byte aligned, not final) so the blocks appended to each other are one stream
+    struct CompressedBlock {
+        std::vector<char> data;       // only kept for the first block of an entry when it's better stored as is
+        std::vector<char> compressed;
+    };
+
+    // a small entry (being) compressed on the pool, waiting for its turn to be appended
+    struct PendingEntry {
+        std::string name;
+        std::future<std::shared_ptr<CompressedBlock>> block;
+        mz_uint64 size = 0;
+        mz_uint32 crc = MZ_CRC32_INIT;
+    };
+
+    static size_t s_read(void* opaque, mz_uint64 offset, void* buffer, size_t n);
+    static std::shared_ptr<CompressedBlock> s_compress(std::vector<char>&& data, int level, bool first, bool last);
+
+    void push(std::vector<char>&& chunk);
+
+    // hands a chunk to the writing thread, waits while it's behind
+    void queue(std::vector<char>&& chunk);
+
+    // starts the thread that writes the current entry from the queued chunks
+    void startWriting(size_t maxSize, int entryLevel, bool precompressed);
+
+    // hands the buffered bytes of the current (big) entry to the pool as its next block. the first block is
+    // compressed right away, it decides if the entry is deflated or stored
+    void submitBlock(bool last);
+
+    // queues the compressed blocks that are ready in order, waits for the oldest while too many are in flight
+    void writeBlocks(bool wait);
+    size_t pull(char* buffer, size_t n);
+
+    // appends the compressed entries that are ready (all of them if wait is true), keeping their order
+    void appendCompressed(bool wait);
+
+    mz_zip_archive zip{};
+    int level;
+    bool finalized = false;
+
+    ThreadPool* pool;
+    bool buffered = false;            // the current entry is small, it's compressed whole on the pool
+    bool parallel = false;            // the current entry is big, its blocks are compressed on the pool
+    size_t maxEntrySize = 0;
+    std::vector<char> bufferedData;   // its bytes that aren't a full block yet
+    PendingEntry current;
+    std::deque<PendingEntry> compressing;
+    std::deque<std::future<std::shared_ptr<CompressedBlock>>> blocks;  // blocks of the big entry in flight
+
+    EntryBuffer entryBuffer;
+    std::ostream entryStream;
+    std::thread compressor;
+    std::string entryName;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::vector<char>> chunks;
+    size_t chunkOffset = 0;  // bytes of chunks.front() already consumed
+    bool closing = false;    // no more chunks for the current entry
+    bool failed = false;     // the compression thread gave up
+};
+
+#endif //ZIP_WRITER_H